@@ -0,0 +1,99 @@
+#include "BarnesHut.h"
+
+#include <cmath>
+
+BarnesHutSolver::BarnesHutSolver()
+	: _theta(0.5f), _leafSize(16), _maxGrowth(0.0f)
+{
+
+}
+
+void BarnesHutSolver::computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	_tree.update(p, _leafSize, _maxGrowth, pool);
+
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+
+	//Particles are walked in tree order so consecutive walks of a thread visit the same nodes
+	pool.parallelFor(indices.size(), 64, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			unsigned int i = indices[k];
+			glm::vec3 a = G * walk(p, glm::vec3(p.x[i], p.y[i], p.z[i]), eps2);
+			p.ax[i] = a.x;
+			p.ay[i] = a.y;
+			p.az[i] = a.z;
+		}
+	});
+}
+
+void BarnesHutSolver::computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2, ThreadPool& pool)
+{
+	_tree.update(p, _leafSize, _maxGrowth, pool);
+
+	pool.parallelFor(targets.size(), 64, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			unsigned int i = targets[k];
+			glm::vec3 a = G * walk(p, glm::vec3(p.x[i], p.y[i], p.z[i]), eps2);
+			p.ax[i] = a.x;
+			p.ay[i] = a.y;
+			p.az[i] = a.z;
+		}
+	});
+}
+
+//Returns the acceleration at pos divided by G
+glm::vec3 BarnesHutSolver::walk(const ParticleArrays& p, const glm::vec3& pos, float eps2) const
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+
+	glm::vec3 a(0.0f);
+	if (nodes.empty()) return a;
+
+	unsigned int stack[8 * 64];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	float invTheta = 1.0f / _theta;
+
+	while (stackSize > 0) {
+		const OctreeNode& node = nodes[stack[--stackSize]];
+
+		glm::vec3 r = pos - node.com; //From the cell to the particle
+		float r2 = r.x * r.x + r.y * r.y + r.z * r.z;
+		float openDist = node.size * invTheta + node.delta;
+
+		if (r2 > openDist * openDist) {
+			float distSqr = r2 + eps2;
+			float invDist = 1.0f / sqrtf(distSqr);
+			float invDist2 = invDist * invDist;
+			float invDist3 = invDist * invDist2;
+			float invDist5 = invDist3 * invDist2;
+
+			//Q.r and r.Q.r
+			const float* q = node.quad;
+			glm::vec3 qr(q[0] * r.x + q[3] * r.y + q[4] * r.z,
+				q[3] * r.x + q[1] * r.y + q[5] * r.z,
+				q[4] * r.x + q[5] * r.y + q[2] * r.z);
+			float rqr = r.x * qr.x + r.y * qr.y + r.z * qr.z;
+
+			a += (-node.mass * invDist3 - 2.5f * rqr * invDist5 * invDist2) * r + invDist5 * qr;
+		}
+		else if (node.childCount == 0) {
+			for (unsigned int k = node.begin; k < node.end; ++k) {
+				unsigned int j = indices[k];
+				glm::vec3 d(p.x[j] - pos.x, p.y[j] - pos.y, p.z[j] - pos.z);
+				float distSqr = d.x * d.x + d.y * d.y + d.z * d.z + eps2;
+				float invDist = 1.0f / sqrtf(distSqr);
+				a += (p.mass[j] * invDist * invDist * invDist) * d;
+			}
+		}
+		else {
+			for (unsigned int c = 0; c < node.childCount; ++c) {
+				stack[stackSize++] = node.firstChild + c;
+			}
+		}
+	}
+
+	return a;
+}
@@ -0,0 +1,34 @@
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+
+#include "ForceSolver.h"
+#include "Octree.h"
+
+//O(N log N) tree solver. Cells are accepted when size / (d - delta) < theta, delta being the offset of their center of mass,
+//and contribute through their monopole and quadrupole moments.
+class BarnesHutSolver : public ForceSolver
+{
+public:
+	BarnesHutSolver();
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+	//The tree is still built over every particle but only the targets walk it
+	virtual void computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2, ThreadPool& pool);
+
+	void setTheta(float theta) { _theta = theta; }
+	float getTheta() const { return _theta; }
+	void setLeafSize(unsigned int leafSize) { _leafSize = leafSize; }
+	//The tree is refitted instead of rebuilt until a cell grows by more than maxGrowth, 0 rebuilding it at every evaluation
+	void setMaxGrowth(float maxGrowth) { _maxGrowth = maxGrowth; }
+	virtual void invalidate() { _tree.invalidate(); }
+
+private:
+	glm::vec3 walk(const ParticleArrays& p, const glm::vec3& pos, float eps2) const;
+
+	Octree _tree;
+	float _theta; //Opening angle
+	unsigned int _leafSize; //Maximum number of particles in a leaf
+	float _maxGrowth;
+};
+
+#endif
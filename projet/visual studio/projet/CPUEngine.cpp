@@ -0,0 +1,662 @@
+#include "CPUEngine.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const size_t BLOCK_SIZE = 64; //Granularity of the per-thread ranges, a multiple of every SIMD width
+
+//Forest & Ruth 1990, theta = 1 / (2 - 2^(1/3))
+static const Composition FOREST_RUTH = {
+	3,
+	{ 0.6756035959798289, -0.17560359597982889, -0.17560359597982889, 0.6756035959798289 },
+	{ 1.3512071919596578, -1.7024143839193155, 1.3512071919596578 }
+};
+
+//Yoshida 1990, solution A: seven leapfrogs of weights w3 w2 w1 w0 w1 w2 w3, adjacent half-drifts merged
+static const Composition YOSHIDA6 = {
+	7,
+	{ 0.39225680523878, 0.5100434119184585, -0.47105338540975655, 0.0687531682525181,
+	0.0687531682525181, -0.47105338540975655, 0.5100434119184585, 0.39225680523878 },
+	{ 0.784513610477560, 0.235573213359357, -1.17767998417887, 1.3151863206839063,
+	-1.17767998417887, 0.235573213359357, 0.784513610477560 }
+};
+
+//Omelyan, Mryglod & Folk 2002, position extended Forest-Ruth like: xi, lambda and chi minimize the error constant
+static const Composition PEFRL = {
+	4,
+	{ 0.1786178958448091, -0.06626458266981849, 0.7752933736500187, -0.06626458266981849, 0.1786178958448091 },
+	{ 0.7123418310626054, -0.2123418310626054, -0.2123418310626054, 0.7123418310626054 }
+};
+
+const Composition* getComposition(unsigned int integrator)
+{
+	switch (integrator) {
+	case CPU_INTEGRATOR_FOREST_RUTH:
+		return &FOREST_RUTH;
+	case CPU_INTEGRATOR_YOSHIDA6:
+		return &YOSHIDA6;
+	case CPU_INTEGRATOR_PEFRL:
+		return &PEFRL;
+	default:
+		return nullptr;
+	}
+}
+
+template<typename Vector>
+static void permuteVector(const std::vector<unsigned int>& order, Vector& values)
+{
+	if (values.size() != order.size()) return;
+
+	Vector tmp(values.size());
+	for (size_t k = 0; k < order.size(); ++k) {
+		tmp[k] = values[order[k]];
+	}
+	values.swap(tmp);
+}
+
+CPUEngine::CPUEngine()
+	: _pool(0), _precision(CPU_PRECISION_FLOAT), _stateValid(false), _reorderInterval(100), _stepsSinceReorder(0),
+	_integrator(CPU_INTEGRATOR_LEAPFROG), _blockEta(0.02f), _maxBlockLevel(10), _forceEvaluationsPerParticle(1.0),
+	_synchronizedVelocities(true), _hermiteValid(false), _adaptive(false), _forcesValid(false), _solver(CPU_DIRECT_SUM)
+{
+
+}
+
+void CPUEngine::step(ParticleArrays& p, float dt, float G, float eps2, bool initialStep)
+{
+	if (_reorderInterval > 0 && (initialStep || _stepsSinceReorder >= _reorderInterval)) {
+		reorder(p);
+	}
+	++_stepsSinceReorder;
+
+	if (_precision == CPU_PRECISION_FLOAT) {
+		integrate(p, dt, G, eps2, initialStep);
+		return;
+	}
+
+	if (initialStep || !_stateValid || _state.size() != p.size()) {
+		_state.assign(p);
+		_stateValid = true;
+		_hermiteValid = false;
+		_forcesValid = false;
+	}
+
+	integrate(_state, static_cast<double>(dt), G, eps2, initialStep);
+
+	//Float copy for the rendering and the diagnostics
+	_pool.parallelFor(p.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			p.x[i] = static_cast<float>(_state.x[i]);
+			p.y[i] = static_cast<float>(_state.y[i]);
+			p.z[i] = static_cast<float>(_state.z[i]);
+			p.vx[i] = static_cast<float>(_state.vx[i]);
+			p.vy[i] = static_cast<float>(_state.vy[i]);
+			p.vz[i] = static_cast<float>(_state.vz[i]);
+			p.ax[i] = static_cast<float>(_state.ax[i]);
+			p.ay[i] = static_cast<float>(_state.ay[i]);
+			p.az[i] = static_cast<float>(_state.az[i]);
+		}
+	});
+}
+
+void CPUEngine::reorder(ParticleArrays& p)
+{
+	mortonOrder(p, _order, _pool);
+	p.permute(_order);
+
+	//The double state follows the same permutation rather than being reloaded from the rounded float copy
+	if (_precision != CPU_PRECISION_FLOAT && _stateValid && _state.size() == p.size()) {
+		_state.permute(_order);
+	}
+
+	permuteVector(_order, _blockLevels);
+	permuteVector(_order, _previousAx);
+	permuteVector(_order, _previousAy);
+	permuteVector(_order, _previousAz);
+
+	_stepsSinceReorder = 0;
+	invalidateSolvers();
+}
+
+void CPUEngine::invalidateState()
+{
+	_stateValid = false;
+	_blockLevels.clear();
+	_hermiteValid = false;
+	_forcesValid = false;
+	invalidateSolvers();
+}
+
+void CPUEngine::invalidateSolvers()
+{
+	_barnesHut.invalidate();
+	_groupTree.invalidate();
+}
+
+void CPUEngine::setTreeReuse(float maxGrowth, unsigned int listReuse)
+{
+	_barnesHut.setMaxGrowth(maxGrowth);
+	_groupTree.setMaxGrowth(maxGrowth);
+	_groupTree.setListReuse(listReuse);
+}
+
+void CPUEngine::setPrecision(unsigned int precision)
+{
+	if (precision >= CPU_PRECISION_COUNT || precision == _precision) return;
+
+	_precision = precision;
+	_stateValid = false;
+	_hermiteValid = false;
+	_forcesValid = false;
+	_directSum.setCompensatedSum(precision == CPU_PRECISION_MIXED);
+	_symmetricDirectSum.setCompensatedSum(precision == CPU_PRECISION_MIXED);
+}
+
+template<typename Real>
+void CPUEngine::integrate(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep)
+{
+	const Composition* composition = getComposition(_integrator);
+
+	if (_adaptive && _integrator != CPU_INTEGRATOR_BLOCK_LEAPFROG) {
+		if (!initialStep && !_synchronizedVelocities) {
+			synchronizeVelocities(p, static_cast<Real>(_timeStepController.getTimeStep()), G, eps2);
+		}
+
+		adaptiveStep(p, dt, G, eps2, initialStep);
+		_blockLevels.clear();
+		_synchronizedVelocities = true;
+		return;
+	}
+
+	_timeStepController.accept(-1.0, dt);
+	_forcesValid = false;
+
+	if (_integrator == CPU_INTEGRATOR_HERMITE || composition) {
+		if (!initialStep && !_synchronizedVelocities) {
+			synchronizeVelocities(p, dt, G, eps2);
+		}
+
+		if (composition) {
+			compositionStep(p, dt, G, eps2, *composition);
+			_forceEvaluationsPerParticle = composition->stages;
+		}
+		else {
+			hermiteStep(p, dt, G, eps2, initialStep);
+			_forceEvaluationsPerParticle = 1.0;
+		}
+		_blockLevels.clear();
+		_synchronizedVelocities = true;
+		return;
+	}
+
+	//Coming from an integrator with synchronized velocities, the velocities need the half-kick of an initial step
+	initialStep = initialStep || _synchronizedVelocities;
+	_synchronizedVelocities = false;
+
+	if (_integrator == CPU_INTEGRATOR_BLOCK_LEAPFROG) {
+		blockStep(p, dt, G, eps2, initialStep);
+	}
+	else {
+		leapfrogStep(p, dt, G, eps2, initialStep);
+		_blockLevels.clear();
+		_forceEvaluationsPerParticle = 1.0;
+	}
+}
+
+template<typename Real>
+void CPUEngine::leapfrogStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep)
+{
+	if (initialStep) {
+		computeForces(p, G, eps2);
+		kick(p, Real(0.5) * dt);
+	}
+
+	drift(p, dt);
+	computeForces(p, G, eps2); //Forces are only evaluated once every position has moved
+	kick(p, dt);
+}
+
+//Fourth-order Hermite scheme (Makino & Aarseth 1992) with the global time step:
+//predict x and v from a and its time derivative j, evaluate a and j at the predicted state, then correct with
+//  v1 = v0 + (a0 + a1) dt / 2 + (j0 - j1) dt^2 / 12
+//  x1 = x0 + (v0 + v1) dt / 2 + (a0 - a1) dt^2 / 12
+//Velocities stay synchronized with the positions, there is no half-kick.
+template<typename Real>
+void CPUEngine::hermiteStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep)
+{
+	size_t n = p.size();
+
+	if (initialStep || !_hermiteValid) {
+		computeForcesAndJerks(p, G, eps2);
+		_hermiteValid = true;
+	}
+
+	BasicParticleArrays<Real>& old = hermiteOld(p);
+	old.resize(n);
+
+	Real dt2 = dt * dt / Real(2);
+	Real dt3 = dt * dt2 / Real(3);
+	_pool.parallelFor(n, BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			old.x[i] = p.x[i]; old.y[i] = p.y[i]; old.z[i] = p.z[i];
+			old.vx[i] = p.vx[i]; old.vy[i] = p.vy[i]; old.vz[i] = p.vz[i];
+			old.ax[i] = p.ax[i]; old.ay[i] = p.ay[i]; old.az[i] = p.az[i];
+			old.jx[i] = p.jx[i]; old.jy[i] = p.jy[i]; old.jz[i] = p.jz[i];
+
+			p.x[i] += dt * p.vx[i] + dt2 * p.ax[i] + dt3 * p.jx[i];
+			p.y[i] += dt * p.vy[i] + dt2 * p.ay[i] + dt3 * p.jy[i];
+			p.z[i] += dt * p.vz[i] + dt2 * p.az[i] + dt3 * p.jz[i];
+			p.vx[i] += dt * p.ax[i] + dt2 * p.jx[i];
+			p.vy[i] += dt * p.ay[i] + dt2 * p.jy[i];
+			p.vz[i] += dt * p.az[i] + dt2 * p.jz[i];
+		}
+	});
+
+	computeForcesAndJerks(p, G, eps2);
+
+	Real half = dt / Real(2);
+	Real twelfth = dt * dt / Real(12);
+	_pool.parallelFor(n, BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			p.vx[i] = old.vx[i] + half * (old.ax[i] + p.ax[i]) + twelfth * (old.jx[i] - p.jx[i]);
+			p.vy[i] = old.vy[i] + half * (old.ay[i] + p.ay[i]) + twelfth * (old.jy[i] - p.jy[i]);
+			p.vz[i] = old.vz[i] + half * (old.az[i] + p.az[i]) + twelfth * (old.jz[i] - p.jz[i]);
+			p.x[i] = old.x[i] + half * (old.vx[i] + p.vx[i]) + twelfth * (old.ax[i] - p.ax[i]);
+			p.y[i] = old.y[i] + half * (old.vy[i] + p.vy[i]) + twelfth * (old.ay[i] - p.ay[i]);
+			p.z[i] = old.z[i] + half * (old.vz[i] + p.vz[i]) + twelfth * (old.az[i] - p.az[i]);
+		}
+	});
+}
+
+//Adaptive step: tau is measured at the start, a first trial step is taken with the extrapolated guess, then the state is restored
+//and the step retaken with (tau(start) + tau(end)) / 2 until dt settles. Every trial costs the force evaluations of a step.
+template<typename Real>
+void CPUEngine::adaptiveStep(BasicParticleArrays<Real>& p, Real dtMax, float G, float eps2, bool initialStep)
+{
+	if (initialStep || !_forcesValid || (_integrator == CPU_INTEGRATOR_HERMITE && !_hermiteValid)) {
+		if (_integrator == CPU_INTEGRATOR_HERMITE) {
+			computeForcesAndJerks(p, G, eps2);
+			_hermiteValid = true;
+		}
+		else {
+			computeForces(p, G, eps2);
+		}
+		_forcesValid = true;
+		_timeStepController.reset();
+	}
+
+	const Composition* composition = getComposition(_integrator);
+	double evaluationsPerStep = composition ? composition->stages + 1 : 1;
+
+	BasicParticleArrays<Real>& saved = savedState(p);
+	copyState(p, saved);
+
+	double start = _timeStepController.criterion(p, eps2, _pool);
+	double dt = _timeStepController.guess(start, dtMax);
+	unsigned int iteration = 0;
+	for (;; ++iteration) {
+		synchronizedStep(p, static_cast<Real>(dt), G, eps2);
+
+		double symmetric = _timeStepController.symmetric(start, _timeStepController.criterion(p, eps2, _pool), dtMax);
+		if (_timeStepController.converged(dt, symmetric, iteration)) break;
+
+		copyState(saved, p);
+		dt = symmetric;
+	}
+
+	_timeStepController.accept(start, dt);
+	_forceEvaluationsPerParticle = (iteration + 1) * evaluationsPerStep;
+}
+
+//One step of the current integrator with velocities synchronized at both ends, ending with the accelerations of the final positions
+template<typename Real>
+void CPUEngine::synchronizedStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2)
+{
+	const Composition* composition = getComposition(_integrator);
+
+	if (_integrator == CPU_INTEGRATOR_HERMITE) {
+		hermiteStep(p, dt, G, eps2, false);
+	}
+	else if (composition) {
+		compositionStep(p, dt, G, eps2, *composition);
+		computeForces(p, G, eps2); //The compositions end with a drift
+	}
+	else {
+		kick(p, Real(0.5) * dt);
+		drift(p, dt);
+		computeForces(p, G, eps2);
+		kick(p, Real(0.5) * dt);
+	}
+}
+
+template<typename Real>
+void CPUEngine::copyState(const BasicParticleArrays<Real>& source, BasicParticleArrays<Real>& destination)
+{
+	destination.resize(source.size());
+	_pool.parallelFor(source.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			destination.x[i] = source.x[i]; destination.y[i] = source.y[i]; destination.z[i] = source.z[i];
+			destination.vx[i] = source.vx[i]; destination.vy[i] = source.vy[i]; destination.vz[i] = source.vz[i];
+			destination.ax[i] = source.ax[i]; destination.ay[i] = source.ay[i]; destination.az[i] = source.az[i];
+			destination.jx[i] = source.jx[i]; destination.jy[i] = source.jy[i]; destination.jz[i] = source.jz[i];
+		}
+	});
+}
+
+//Drift-kick composition, the forces being evaluated after every drift. Velocities stay synchronized with the positions.
+template<typename Real>
+void CPUEngine::compositionStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, const Composition& composition)
+{
+	for (unsigned int s = 0; s < composition.stages; ++s) {
+		drift(p, static_cast<Real>(composition.drift[s]) * dt);
+		computeForces(p, G, eps2);
+		kick(p, static_cast<Real>(composition.kick[s]) * dt);
+	}
+	drift(p, static_cast<Real>(composition.drift[composition.stages]) * dt);
+}
+
+//The leapfrogs leave the velocities half a step ahead of the positions, bring them back before an integrator with synchronized velocities
+template<typename Real>
+void CPUEngine::synchronizeVelocities(BasicParticleArrays<Real>& p, Real dt, float G, float eps2)
+{
+	size_t n = p.size();
+	bool block = _blockLevels.size() == n;
+	unsigned int ticks = 1u << _maxBlockLevel;
+
+	computeForces(p, G, eps2);
+	_pool.parallelFor(n, BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			Real half = Real(0.5) * (block ? dt * (ticks >> _blockLevels[i]) / ticks : dt);
+			p.vx[i] -= half * p.ax[i];
+			p.vy[i] -= half * p.ay[i];
+			p.vz[i] -= half * p.az[i];
+		}
+	});
+	_hermiteValid = false;
+}
+
+//Hierarchical block time steps (kick-drift-kick with individual steps).
+//Time inside the global step dt is counted in ticks of dt / 2^maxLevel. A particle at level L has a step of 2^(maxLevel - L) ticks
+//and its steps always start on a multiple of their length, so it is active exactly at the times that are multiples of its step.
+//Every substep drifts all the particles, which predicts the positions of the inactive ones with their current velocity,
+//then only the active particles get new forces, their closing half-kick, a new level and their opening half-kick.
+template<typename Real>
+void CPUEngine::blockStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep)
+{
+	size_t n = p.size();
+	if (n == 0) return;
+
+	unsigned int ticks = 1u << _maxBlockLevel;
+	Real unit = dt / ticks;
+
+	if (initialStep || _blockLevels.size() != n) {
+		_previousAx.assign(n, 0.0);
+		_previousAy.assign(n, 0.0);
+		_previousAz.assign(n, 0.0);
+
+		if (initialStep) {
+			computeForces(p, G, eps2);
+			_blockLevels.resize(n);
+			for (size_t i = 0; i < n; ++i) {
+				_blockLevels[i] = chooseBlockLevel(p, static_cast<unsigned int>(i), dt, Real(0), eps2);
+			}
+		}
+		else {
+			//Velocities already are half a global step ahead, as left by the global leapfrog
+			_blockLevels.assign(n, 0);
+		}
+
+		_pool.parallelFor(n, BLOCK_SIZE, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				if (initialStep) {
+					Real half = Real(0.5) * (unit * (ticks >> _blockLevels[i]));
+					p.vx[i] += half * p.ax[i];
+					p.vy[i] += half * p.ay[i];
+					p.vz[i] += half * p.az[i];
+				}
+				_previousAx[i] = p.ax[i];
+				_previousAy[i] = p.ay[i];
+				_previousAz[i] = p.az[i];
+			}
+		});
+	}
+
+	size_t evaluations = 0;
+	unsigned int time = 0;
+	while (time < ticks) {
+		unsigned int deepest = *std::max_element(_blockLevels.begin(), _blockLevels.end());
+		unsigned int smallestStep = ticks >> deepest;
+		unsigned int next = (time / smallestStep + 1) * smallestStep;
+
+		drift(p, unit * (next - time));
+		time = next;
+
+		//Largest step ending now: particles at this level or deeper are active
+		unsigned int activeLevel = _maxBlockLevel;
+		while (activeLevel > 0 && time % (ticks >> (activeLevel - 1)) == 0) --activeLevel;
+
+		_active.clear();
+		for (size_t i = 0; i < n; ++i) {
+			if (_blockLevels[i] >= activeLevel) _active.push_back(static_cast<unsigned int>(i));
+		}
+		evaluations += _active.size();
+
+		computeForces(p, _active, G, eps2);
+
+		_pool.parallelFor(_active.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+			for (size_t k = begin; k < end; ++k) {
+				unsigned int i = _active[k];
+				Real previousStep = unit * (ticks >> _blockLevels[i]);
+
+				//Closing half-kick of the step that just ended
+				p.vx[i] += Real(0.5) * previousStep * p.ax[i];
+				p.vy[i] += Real(0.5) * previousStep * p.ay[i];
+				p.vz[i] += Real(0.5) * previousStep * p.az[i];
+
+				//The new step may at most double and has to start on a multiple of its length
+				unsigned int level = chooseBlockLevel(p, i, dt, previousStep, eps2);
+				level = std::max(level, _blockLevels[i] > 0 ? _blockLevels[i] - 1 : 0u);
+				while (time % (ticks >> level) != 0) ++level;
+				_blockLevels[i] = level;
+
+				//Opening half-kick of the new step
+				Real half = Real(0.5) * (unit * (ticks >> level));
+				p.vx[i] += half * p.ax[i];
+				p.vy[i] += half * p.ay[i];
+				p.vz[i] += half * p.az[i];
+
+				_previousAx[i] = p.ax[i];
+				_previousAy[i] = p.ay[i];
+				_previousAz[i] = p.az[i];
+			}
+		});
+	}
+
+	_forceEvaluationsPerParticle = n > 0 ? static_cast<double>(evaluations) / n : 1.0;
+}
+
+//Aarseth-style criterion eta * |a| / |da/dt|, the jerk being estimated from the two last force evaluations.
+//Without history, or when the jerk vanishes, falls back to sqrt(2 eta eps / |a|).
+template<typename Real>
+unsigned int CPUEngine::chooseBlockLevel(const BasicParticleArrays<Real>& p, unsigned int i, Real dtMax, Real dtPrevious, float eps2) const
+{
+	double ax = p.ax[i], ay = p.ay[i], az = p.az[i];
+	double accel = std::sqrt(ax * ax + ay * ay + az * az);
+
+	double dt = dtMax;
+	if (accel > 0.0) {
+		dt = std::sqrt(2.0 * _blockEta * std::sqrt(static_cast<double>(eps2)) / accel);
+
+		if (dtPrevious > 0) {
+			double jx = ax - _previousAx[i], jy = ay - _previousAy[i], jz = az - _previousAz[i];
+			double jerk = std::sqrt(jx * jx + jy * jy + jz * jz) / dtPrevious;
+			if (jerk > 0.0) dt = _blockEta * accel / jerk;
+		}
+	}
+
+	unsigned int level = 0;
+	double step = dtMax;
+	while (step > dt && level < _maxBlockLevel) {
+		step *= 0.5;
+		++level;
+	}
+	return level;
+}
+
+void CPUEngine::computeForces(ParticleArrays& p, float G, float eps2)
+{
+	computeAccelerations(p, G, eps2);
+}
+
+void CPUEngine::computeForces(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2)
+{
+	currentSolver().computeAccelerations(p, targets, G, eps2, _pool);
+}
+
+void CPUEngine::computeForces(DoubleParticleArrays& p, float G, float eps2)
+{
+	if (_precision == CPU_PRECISION_DOUBLE && _solver == CPU_DIRECT_SUM) {
+		_directSum.computeAccelerations(p, G, eps2, _pool);
+		return;
+	}
+	if (_precision == CPU_PRECISION_DOUBLE && _solver == CPU_DIRECT_SUM_SYMMETRIC) {
+		_symmetricDirectSum.computeAccelerations(p, G, eps2, _pool);
+		return;
+	}
+
+	//The other solvers work on a float copy of the positions, their own approximation error dominating the float rounding
+	updateMirror(p);
+	computeAccelerations(_mirror, G, eps2);
+
+	_pool.parallelFor(p.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			p.ax[i] = _mirror.ax[i];
+			p.ay[i] = _mirror.ay[i];
+			p.az[i] = _mirror.az[i];
+		}
+	});
+}
+
+void CPUEngine::computeForces(DoubleParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2)
+{
+	if (_precision == CPU_PRECISION_DOUBLE && _solver == CPU_DIRECT_SUM) {
+		_directSum.computeAccelerations(p, targets, G, eps2, _pool);
+		return;
+	}
+	if (_precision == CPU_PRECISION_DOUBLE && _solver == CPU_DIRECT_SUM_SYMMETRIC) {
+		//Pairs are only symmetric over all the particles, so every particle is evaluated like the float solver does
+		_symmetricDirectSum.computeAccelerations(p, G, eps2, _pool);
+		return;
+	}
+
+	updateMirror(p);
+	currentSolver().computeAccelerations(_mirror, targets, G, eps2, _pool);
+
+	_pool.parallelFor(targets.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			unsigned int i = targets[k];
+			p.ax[i] = _mirror.ax[i];
+			p.ay[i] = _mirror.ay[i];
+			p.az[i] = _mirror.az[i];
+		}
+	});
+}
+
+//The Hermite integrator needs the direct sum for the jerk, whatever the selected solver
+void CPUEngine::computeForcesAndJerks(ParticleArrays& p, float G, float eps2)
+{
+	directSumAccelJerk(p, G, eps2, _pool);
+}
+
+void CPUEngine::computeForcesAndJerks(DoubleParticleArrays& p, float G, float eps2)
+{
+	if (_precision == CPU_PRECISION_DOUBLE) {
+		directSumAccelJerk(p, G, eps2, _pool);
+		return;
+	}
+
+	updateMirror(p, true);
+	directSumAccelJerk(_mirror, G, eps2, _pool);
+
+	_pool.parallelFor(p.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			p.ax[i] = _mirror.ax[i]; p.ay[i] = _mirror.ay[i]; p.az[i] = _mirror.az[i];
+			p.jx[i] = _mirror.jx[i]; p.jy[i] = _mirror.jy[i]; p.jz[i] = _mirror.jz[i];
+		}
+	});
+}
+
+void CPUEngine::updateMirror(const DoubleParticleArrays& p, bool withVelocities)
+{
+	_mirror.resize(p.size());
+	_pool.parallelFor(p.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			_mirror.x[i] = static_cast<float>(p.x[i]);
+			_mirror.y[i] = static_cast<float>(p.y[i]);
+			_mirror.z[i] = static_cast<float>(p.z[i]);
+			_mirror.mass[i] = static_cast<float>(p.mass[i]);
+			if (withVelocities) {
+				_mirror.vx[i] = static_cast<float>(p.vx[i]);
+				_mirror.vy[i] = static_cast<float>(p.vy[i]);
+				_mirror.vz[i] = static_cast<float>(p.vz[i]);
+			}
+		}
+	});
+}
+
+void CPUEngine::computeAccelerations(ParticleArrays& p, float G, float eps2)
+{
+	currentSolver().computeAccelerations(p, G, eps2, _pool);
+}
+
+void CPUEngine::computeEnergy(const ParticleArrays& p, float G, float eps2, double& kinetic, double& potential)
+{
+	kinetic = 0.0;
+	for (size_t i = 0; i < p.size(); ++i) {
+		kinetic += 0.5 * p.mass[i] * (p.vx[i] * p.vx[i] + p.vy[i] * p.vy[i] + p.vz[i] * p.vz[i]);
+	}
+
+	potential = directSumPotentialEnergy(p, G, eps2, _pool);
+}
+
+ForceSolver& CPUEngine::currentSolver()
+{
+	switch (_solver) {
+	case CPU_DIRECT_SUM_SYMMETRIC:
+		return _symmetricDirectSum;
+	case CPU_BARNES_HUT:
+		return _barnesHut;
+	case CPU_GROUP_TREE:
+		return _groupTree;
+	case CPU_FMM:
+		return _fmm;
+	case CPU_PARTICLE_MESH:
+		return _particleMesh;
+	default:
+		return _directSum;
+	}
+}
+
+template<typename Real>
+void CPUEngine::kick(BasicParticleArrays<Real>& p, Real dt)
+{
+	_pool.parallelFor(p.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			p.vx[i] += dt * p.ax[i];
+			p.vy[i] += dt * p.ay[i];
+			p.vz[i] += dt * p.az[i];
+		}
+	});
+}
+
+template<typename Real>
+void CPUEngine::drift(BasicParticleArrays<Real>& p, Real dt)
+{
+	_pool.parallelFor(p.size(), BLOCK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			p.x[i] += dt * p.vx[i];
+			p.y[i] += dt * p.vy[i];
+			p.z[i] += dt * p.vz[i];
+		}
+	});
+}
@@ -0,0 +1,189 @@
+#ifndef CPUENGINE_H
+#define CPUENGINE_H
+
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+#include "DirectSum.h"
+#include "BarnesHut.h"
+#include "GroupTree.h"
+#include "FMM.h"
+#include "ParticleMesh.h"
+#include "Morton.h"
+#include "TimeStepController.h"
+
+enum CPUSolver
+{
+	CPU_DIRECT_SUM = 0,
+	CPU_DIRECT_SUM_SYMMETRIC,
+	CPU_BARNES_HUT,
+	CPU_FMM,
+	CPU_PARTICLE_MESH,
+	CPU_GROUP_TREE, //Barnes-Hut walked once per group of particles
+	CPU_SOLVER_COUNT
+};
+
+enum CPUIntegrator
+{
+	CPU_INTEGRATOR_LEAPFROG = 0, //Kick-drift-kick with the global time step
+	CPU_INTEGRATOR_BLOCK_LEAPFROG, //Kick-drift-kick with individual power-of-two time steps
+	CPU_INTEGRATOR_HERMITE, //Fourth-order Hermite predictor-corrector, always evaluated with the direct sum
+	CPU_INTEGRATOR_FOREST_RUTH, //Fourth-order symplectic composition, 3 force evaluations per step
+	CPU_INTEGRATOR_YOSHIDA6, //Sixth-order symplectic composition, 7 force evaluations per step
+	CPU_INTEGRATOR_PEFRL, //Fourth-order symplectic composition with an optimized error constant, 4 force evaluations per step
+	CPU_INTEGRATOR_COUNT
+};
+
+//Symplectic integrator written as drift(d0) kick(k0) drift(d1) ... kick(k[stages - 1]) drift(d[stages]), in fractions of the time step
+struct Composition
+{
+	unsigned int stages;
+	double drift[8];
+	double kick[7];
+};
+
+//Coefficients of a composition integrator, nullptr for the other integrators
+const Composition* getComposition(unsigned int integrator);
+
+//Scalar type of the CPU engine.
+//Double and mixed keep the particle state in double so long runs do not drift from the rounding of positions and velocities.
+enum CPUPrecision
+{
+	CPU_PRECISION_FLOAT = 0,
+	CPU_PRECISION_DOUBLE, //Direct sums are evaluated in double, the approximate solvers on a float copy of the positions
+	CPU_PRECISION_MIXED, //Pairs evaluated in float, direct sums accumulated with Kahan compensation
+	CPU_PRECISION_COUNT
+};
+
+//Runs the simulation on the CPU over a persistent pool of threads.
+//Each step is split in phases (drift, force, kick) so every particle sees a consistent state during the force evaluation.
+class CPUEngine
+{
+public:
+	CPUEngine();
+
+	//Advances the particles by dt with the current integrator. When initialStep is true, the velocities first receive an euler half-step.
+	//In double and mixed precision p is only a float copy of the engine state, reloaded from p on the initial step or after invalidateState().
+	void step(ParticleArrays& p, float dt, float G, float eps2, bool initialStep);
+	//Computes the accelerations of all the particles in parallel with the current solver
+	void computeAccelerations(ParticleArrays& p, float G, float eps2);
+	//Kinetic and potential energy, the potential being an exact O(N^2) pair sum
+	void computeEnergy(const ParticleArrays& p, float G, float eps2, double& kinetic, double& potential);
+
+	void setPrecision(unsigned int precision);
+	unsigned int getPrecision() const { return _precision; }
+	void invalidateState(); //To call when the particles are modified outside of step
+	void setSynchronizedVelocities(bool synchronized) { _synchronizedVelocities = synchronized; } //Convention of velocities set outside of step
+
+	void setIntegrator(unsigned int integrator) { if (integrator < CPU_INTEGRATOR_COUNT) { _integrator = integrator; _hermiteValid = false; } }
+	unsigned int getIntegrator() const { return _integrator; }
+	//Block time steps: particle i advances by dt / 2^level_i, level_i being chosen from eta * |a| / |da/dt|
+	void setBlockAccuracy(float eta) { _blockEta = eta; }
+	void setMaxBlockLevel(unsigned int level) { _maxBlockLevel = level < 20 ? level : 20; _blockLevels.clear(); }
+	//Adaptive global time step chosen by the controller, the dt given to step becoming the largest allowed step.
+	//Leapfrog velocities are then kept synchronized with the positions. The block time steps already adapt and ignore it.
+	void setAdaptiveTimeStep(bool adaptive) { _adaptive = adaptive; _forcesValid = false; }
+	bool isAdaptiveTimeStep() const { return _adaptive; }
+	TimeStepController& getTimeStepController() { return _timeStepController; }
+	double getTimeStep() const { return _timeStepController.getTimeStep(); } //Time step of the last step
+
+	//Force evaluations of the last step divided by the number of particles, 1 for the leapfrog and Hermite, the stage count for the compositions
+	double getForceEvaluationsPerParticle() const { return _forceEvaluationsPerParticle; }
+
+	//Sorts the particles along the Morton curve. step calls it on the initial step and then every reorder interval steps.
+	void reorder(ParticleArrays& p);
+	void setReorderInterval(unsigned int steps) { _reorderInterval = steps; } //0 disables the periodic reordering
+
+	void setSolver(unsigned int solver) { if (solver < CPU_SOLVER_COUNT) _solver = solver; }
+	unsigned int getSolver() const { return _solver; }
+	void setTheta(float theta) { _barnesHut.setTheta(theta); _fmm.setTheta(theta); _groupTree.setTheta(theta); }
+	//Tree solvers refit their tree between steps until a cell grows by more than maxGrowth (0 rebuilds at every evaluation),
+	//the group walk reusing its interaction lists for listReuse evaluations
+	void setTreeReuse(float maxGrowth, unsigned int listReuse);
+	void setFMMOrder(unsigned int order) { _fmm.setOrder(order); }
+	void setMeshSize(unsigned int size) { _particleMesh.setMeshSize(size); }
+	void setMassAssignment(unsigned int assignment) { _particleMesh.setAssignment(assignment); }
+	void setOptimizationLevel(unsigned int level) { _directSum.setOptimizationLevel(level); } //Same tiers as the GPU shader
+	void setDirectSumTiling(size_t tileSize, size_t unroll) { _directSum.setTileSize(tileSize); _directSum.setUnroll(unroll); }
+
+	void setThreadCount(unsigned int threadCount) { _pool.setThreadCount(threadCount); } //0 = one thread per hardware core
+	unsigned int getThreadCount() const { return _pool.getThreadCount(); }
+	ThreadPool& getThreadPool() { return _pool; }
+
+private:
+	ForceSolver& currentSolver();
+	void invalidateSolvers();
+	template<typename Real>
+	void integrate(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep);
+	template<typename Real>
+	void adaptiveStep(BasicParticleArrays<Real>& p, Real dtMax, float G, float eps2, bool initialStep);
+	template<typename Real>
+	void synchronizedStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2);
+	template<typename Real>
+	void copyState(const BasicParticleArrays<Real>& source, BasicParticleArrays<Real>& destination);
+	template<typename Real>
+	void leapfrogStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep);
+	template<typename Real>
+	void blockStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep);
+	template<typename Real>
+	void hermiteStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, bool initialStep);
+	template<typename Real>
+	void compositionStep(BasicParticleArrays<Real>& p, Real dt, float G, float eps2, const Composition& composition);
+	template<typename Real>
+	void synchronizeVelocities(BasicParticleArrays<Real>& p, Real dt, float G, float eps2);
+	template<typename Real>
+	unsigned int chooseBlockLevel(const BasicParticleArrays<Real>& p, unsigned int i, Real dtMax, Real dtPrevious, float eps2) const;
+	void computeForces(ParticleArrays& p, float G, float eps2);
+	void computeForces(DoubleParticleArrays& p, float G, float eps2);
+	void computeForces(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2);
+	void computeForces(DoubleParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2);
+	void computeForcesAndJerks(ParticleArrays& p, float G, float eps2);
+	void computeForcesAndJerks(DoubleParticleArrays& p, float G, float eps2);
+	void updateMirror(const DoubleParticleArrays& p, bool withVelocities = false);
+	ParticleArrays& hermiteOld(ParticleArrays&) { return _hermiteOld; }
+	DoubleParticleArrays& hermiteOld(DoubleParticleArrays&) { return _doubleHermiteOld; }
+	ParticleArrays& savedState(ParticleArrays&) { return _savedState; }
+	DoubleParticleArrays& savedState(DoubleParticleArrays&) { return _doubleSavedState; }
+	template<typename Real>
+	void kick(BasicParticleArrays<Real>& p, Real dt);
+	template<typename Real>
+	void drift(BasicParticleArrays<Real>& p, Real dt);
+
+	ThreadPool _pool;
+
+	unsigned int _precision;
+	DoubleParticleArrays _state; //Engine state in double and mixed precision
+	ParticleArrays _mirror; //Float copy of _state handed to the float solvers
+	bool _stateValid;
+
+	unsigned int _reorderInterval;
+	unsigned int _stepsSinceReorder;
+	std::vector<unsigned int> _order;
+
+	unsigned int _integrator;
+	float _blockEta;
+	unsigned int _maxBlockLevel;
+	std::vector<unsigned int> _blockLevels; //Empty when the block state has to be rebuilt
+	std::vector<double> _previousAx, _previousAy, _previousAz; //Acceleration at the previous force evaluation, for the jerk
+	std::vector<unsigned int> _active;
+	double _forceEvaluationsPerParticle;
+	bool _synchronizedVelocities; //False when the velocities are half a step ahead of the positions, as left by the leapfrogs
+	bool _hermiteValid; //The accelerations and jerks of the state are up to date
+	ParticleArrays _hermiteOld; //State at the beginning of the Hermite step
+	DoubleParticleArrays _doubleHermiteOld;
+
+	bool _adaptive;
+	TimeStepController _timeStepController;
+	bool _forcesValid; //The accelerations of the state match its positions
+	ParticleArrays _savedState; //State at the beginning of an adaptive step, restored between the trial steps
+	DoubleParticleArrays _doubleSavedState;
+
+	unsigned int _solver;
+	DirectSumSolver _directSum;
+	SymmetricDirectSumSolver _symmetricDirectSum;
+	BarnesHutSolver _barnesHut;
+	GroupTreeSolver _groupTree;
+	FMMSolver _fmm;
+	ParticleMeshSolver _particleMesh;
+};
+
+#endif
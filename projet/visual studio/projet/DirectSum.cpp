@@ -0,0 +1,782 @@
+#include "DirectSum.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const size_t ROW_BLOCK = 16; //Rows are dealt cyclically to the threads by blocks to balance the triangular loop
+static const size_t ROWS = 4; //Register block of the symmetric kernel
+
+//Adds the acceleration exerted by the broadcast source (qx, qy, qz, qm) on the targets (px, py, pz)
+static inline void interact(vfloat qx, vfloat qy, vfloat qz, vfloat qm, vfloat px, vfloat py, vfloat pz, vfloat vEps2,
+	vfloat& accX, vfloat& accY, vfloat& accZ)
+{
+	vfloat rx = vsub(qx, px);
+	vfloat ry = vsub(qy, py);
+	vfloat rz = vsub(qz, pz);
+
+	vfloat distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+	vfloat invDist = vrsqrt(distSqr);
+	vfloat s = vmul(qm, vmul(invDist, vmul(invDist, invDist)));
+
+	accX = vfmadd(s, rx, accX);
+	accY = vfmadd(s, ry, accY);
+	accZ = vfmadd(s, rz, accZ);
+}
+
+static inline void storeAccel(vfloat accX, vfloat accY, vfloat accZ, vfloat vG, float* ax, float* ay, float* az)
+{
+	vstore(ax, vfmadd(accX, vG, vload(ax)));
+	vstore(ay, vfmadd(accY, vG, vload(ay)));
+	vstore(az, vfmadd(accZ, vG, vload(az)));
+}
+
+//Computes the acceleration of SIMD_WIDTH targets starting at the given pointers
+static inline void accelBlock(const float* tx, const float* ty, const float* tz,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	vfloat vG, vfloat vEps2, float* ax, float* ay, float* az)
+{
+	vfloat px = vload(tx), py = vload(ty), pz = vload(tz);
+	vfloat accX = vzero(), accY = vzero(), accZ = vzero();
+
+	for (size_t j = 0; j < nSources; ++j) {
+		interact(vset1(sx[j]), vset1(sy[j]), vset1(sz[j]), vset1(sm[j]), px, py, pz, vEps2, accX, accY, accZ);
+	}
+
+	storeAccel(accX, accY, accZ, vG, ax, ay, az);
+}
+
+//Register blocks of 2 and 4 target vectors: each broadcast source is reused by every vector,
+//which cuts the loads per interaction and gives independent FMA chains to hide their latency.
+//The block is written out by hand because compilers keep arrays of vectors in memory instead of registers.
+static inline void accelBlock2(const float* tx, const float* ty, const float* tz,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	vfloat vG, vfloat vEps2, float* ax, float* ay, float* az)
+{
+	const size_t W = SIMD_WIDTH;
+	vfloat px0 = vload(tx), py0 = vload(ty), pz0 = vload(tz);
+	vfloat px1 = vload(tx + W), py1 = vload(ty + W), pz1 = vload(tz + W);
+	vfloat accX0 = vzero(), accY0 = vzero(), accZ0 = vzero();
+	vfloat accX1 = vzero(), accY1 = vzero(), accZ1 = vzero();
+
+	for (size_t j = 0; j < nSources; ++j) {
+		vfloat qx = vset1(sx[j]), qy = vset1(sy[j]), qz = vset1(sz[j]), qm = vset1(sm[j]);
+		interact(qx, qy, qz, qm, px0, py0, pz0, vEps2, accX0, accY0, accZ0);
+		interact(qx, qy, qz, qm, px1, py1, pz1, vEps2, accX1, accY1, accZ1);
+	}
+
+	storeAccel(accX0, accY0, accZ0, vG, ax, ay, az);
+	storeAccel(accX1, accY1, accZ1, vG, ax + W, ay + W, az + W);
+}
+
+static inline void accelBlock4(const float* tx, const float* ty, const float* tz,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	vfloat vG, vfloat vEps2, float* ax, float* ay, float* az)
+{
+	const size_t W = SIMD_WIDTH;
+	vfloat px0 = vload(tx), py0 = vload(ty), pz0 = vload(tz);
+	vfloat px1 = vload(tx + W), py1 = vload(ty + W), pz1 = vload(tz + W);
+	vfloat px2 = vload(tx + 2 * W), py2 = vload(ty + 2 * W), pz2 = vload(tz + 2 * W);
+	vfloat px3 = vload(tx + 3 * W), py3 = vload(ty + 3 * W), pz3 = vload(tz + 3 * W);
+	vfloat accX0 = vzero(), accY0 = vzero(), accZ0 = vzero();
+	vfloat accX1 = vzero(), accY1 = vzero(), accZ1 = vzero();
+	vfloat accX2 = vzero(), accY2 = vzero(), accZ2 = vzero();
+	vfloat accX3 = vzero(), accY3 = vzero(), accZ3 = vzero();
+
+	for (size_t j = 0; j < nSources; ++j) {
+		vfloat qx = vset1(sx[j]), qy = vset1(sy[j]), qz = vset1(sz[j]), qm = vset1(sm[j]);
+		interact(qx, qy, qz, qm, px0, py0, pz0, vEps2, accX0, accY0, accZ0);
+		interact(qx, qy, qz, qm, px1, py1, pz1, vEps2, accX1, accY1, accZ1);
+		interact(qx, qy, qz, qm, px2, py2, pz2, vEps2, accX2, accY2, accZ2);
+		interact(qx, qy, qz, qm, px3, py3, pz3, vEps2, accX3, accY3, accZ3);
+	}
+
+	storeAccel(accX0, accY0, accZ0, vG, ax, ay, az);
+	storeAccel(accX1, accY1, accZ1, vG, ax + W, ay + W, az + W);
+	storeAccel(accX2, accY2, accZ2, vG, ax + 2 * W, ay + 2 * W, az + 2 * W);
+	storeAccel(accX3, accY3, accZ3, vG, ax + 3 * W, ay + 3 * W, az + 3 * W);
+}
+
+//Calls block(tx, ty, tz, ax, ay, az) on every group of Width consecutive targets.
+//Remaining targets go through a zero-padded copy so the kernels never read or write past the arrays.
+template<size_t Width, typename T, typename Block>
+static void forEachTargetBlock(const T* tx, const T* ty, const T* tz, size_t nTargets, T* ax, T* ay, T* az, Block block)
+{
+	size_t fullEnd = nTargets - nTargets % Width;
+	for (size_t i = 0; i < fullEnd; i += Width) {
+		block(tx + i, ty + i, tz + i, ax + i, ay + i, az + i);
+	}
+
+	size_t remaining = nTargets - fullEnd;
+	if (remaining > 0) {
+		T bx[Width] = {}, by[Width] = {}, bz[Width] = {};
+		T bax[Width] = {}, bay[Width] = {}, baz[Width] = {};
+		std::copy(tx + fullEnd, tx + nTargets, bx);
+		std::copy(ty + fullEnd, ty + nTargets, by);
+		std::copy(tz + fullEnd, tz + nTargets, bz);
+		std::copy(ax + fullEnd, ax + nTargets, bax);
+		std::copy(ay + fullEnd, ay + nTargets, bay);
+		std::copy(az + fullEnd, az + nTargets, baz);
+
+		block(bx, by, bz, bax, bay, baz);
+
+		std::copy(bax, bax + remaining, ax + fullEnd);
+		std::copy(bay, bay + remaining, ay + fullEnd);
+		std::copy(baz, baz + remaining, az + fullEnd);
+	}
+}
+
+void directSumAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	float G, float eps2, float* ax, float* ay, float* az)
+{
+	vfloat vG = vset1(G);
+	vfloat vEps2 = vset1(eps2);
+
+	forEachTargetBlock<SIMD_WIDTH>(tx, ty, tz, nTargets, ax, ay, az,
+		[&](const float* bx, const float* by, const float* bz, float* bax, float* bay, float* baz) {
+		accelBlock(bx, by, bz, sx, sy, sz, sm, nSources, vG, vEps2, bax, bay, baz);
+	});
+}
+
+//Kahan summation: acc + term with the rounding error carried in compensation
+template<typename V>
+static inline void compensatedAdd(V term, V& acc, V& compensation)
+{
+	V y = vsub(term, compensation);
+	V t = vadd(acc, y);
+	compensation = vsub(vsub(t, acc), y);
+	acc = t;
+}
+
+template<typename Real>
+static inline void scalarCompensatedAdd(Real term, Real& acc, Real& compensation)
+{
+	Real y = term - compensation;
+	Real t = acc + y;
+	compensation = (t - acc) - y;
+	acc = t;
+}
+
+void compensatedDirectSumAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	float G, float eps2, float* ax, float* ay, float* az)
+{
+	vfloat vG = vset1(G);
+	vfloat vEps2 = vset1(eps2);
+
+	forEachTargetBlock<SIMD_WIDTH>(tx, ty, tz, nTargets, ax, ay, az,
+		[&](const float* bx, const float* by, const float* bz, float* bax, float* bay, float* baz) {
+		vfloat px = vload(bx), py = vload(by), pz = vload(bz);
+		vfloat accX = vzero(), accY = vzero(), accZ = vzero();
+		vfloat compX = vzero(), compY = vzero(), compZ = vzero();
+
+		for (size_t j = 0; j < nSources; ++j) {
+			vfloat rx = vsub(vset1(sx[j]), px);
+			vfloat ry = vsub(vset1(sy[j]), py);
+			vfloat rz = vsub(vset1(sz[j]), pz);
+
+			vfloat distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+			vfloat invDist = vrsqrt(distSqr);
+			vfloat s = vmul(vset1(sm[j]), vmul(invDist, vmul(invDist, invDist)));
+
+			compensatedAdd(vmul(s, rx), accX, compX);
+			compensatedAdd(vmul(s, ry), accY, compY);
+			compensatedAdd(vmul(s, rz), accZ, compZ);
+		}
+
+		storeAccel(accX, accY, accZ, vG, bax, bay, baz);
+	});
+}
+
+void directSumAccel(const double* tx, const double* ty, const double* tz, size_t nTargets,
+	const double* sx, const double* sy, const double* sz, const double* sm, size_t nSources,
+	double G, double eps2, double* ax, double* ay, double* az)
+{
+	vdouble vG = vset1(G);
+	vdouble vEps2 = vset1(eps2);
+
+	forEachTargetBlock<DSIMD_WIDTH>(tx, ty, tz, nTargets, ax, ay, az,
+		[&](const double* bx, const double* by, const double* bz, double* bax, double* bay, double* baz) {
+		vdouble px = vload(bx), py = vload(by), pz = vload(bz);
+		vdouble accX = vzerod(), accY = vzerod(), accZ = vzerod();
+
+		for (size_t j = 0; j < nSources; ++j) {
+			vdouble rx = vsub(vset1(sx[j]), px);
+			vdouble ry = vsub(vset1(sy[j]), py);
+			vdouble rz = vsub(vset1(sz[j]), pz);
+
+			vdouble distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+			vdouble s = vdiv(vset1(sm[j]), vmul(distSqr, vsqrt(distSqr)));
+
+			accX = vfmadd(s, rx, accX);
+			accY = vfmadd(s, ry, accY);
+			accZ = vfmadd(s, rz, accZ);
+		}
+
+		vstore(bax, vfmadd(accX, vG, vload(bax)));
+		vstore(bay, vfmadd(accY, vG, vload(bay)));
+		vstore(baz, vfmadd(accZ, vG, vload(baz)));
+	});
+}
+
+void tiledDirectSumAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	float G, float eps2, float* ax, float* ay, float* az, size_t tileSize, size_t unroll)
+{
+	vfloat vG = vset1(G);
+	vfloat vEps2 = vset1(eps2);
+
+	for (size_t tile = 0; tile < nSources; tile += tileSize) {
+		size_t nTile = std::min(tileSize, nSources - tile);
+		const float* tsx = sx + tile;
+		const float* tsy = sy + tile;
+		const float* tsz = sz + tile;
+		const float* tsm = sm + tile;
+
+		size_t i = 0;
+		if (unroll >= 4) {
+			for (; i + 4 * SIMD_WIDTH <= nTargets; i += 4 * SIMD_WIDTH) {
+				accelBlock4(tx + i, ty + i, tz + i, tsx, tsy, tsz, tsm, nTile, vG, vEps2, ax + i, ay + i, az + i);
+			}
+		}
+		if (unroll >= 2) {
+			for (; i + 2 * SIMD_WIDTH <= nTargets; i += 2 * SIMD_WIDTH) {
+				accelBlock2(tx + i, ty + i, tz + i, tsx, tsy, tsz, tsm, nTile, vG, vEps2, ax + i, ay + i, az + i);
+			}
+		}
+
+		//Single vectors and the padded tail
+		directSumAccel(tx + i, ty + i, tz + i, nTargets - i, tsx, tsy, tsz, tsm, nTile, G, eps2, ax + i, ay + i, az + i);
+	}
+}
+
+DirectSumSolver::DirectSumSolver()
+	: _opLevel(2), _compensated(false), _tileSize(1024),
+	_unroll(SIMD_WIDTH >= 16 ? 4 : 2) //4 blocks need 24 registers for positions and accumulators, only AVX-512 has enough
+{
+}
+
+//Plain scalar float nested loop, kept as the reference point of the optimization levels
+static void naiveDirectSumAccel(const ParticleArrays& p, size_t begin, size_t end, float G, float eps2, float* ax, float* ay, float* az)
+{
+	size_t n = p.size();
+	for (size_t i = begin; i < end; ++i) {
+		float accX = 0.0f, accY = 0.0f, accZ = 0.0f;
+		for (size_t j = 0; j < n; ++j) {
+			float rx = p.x[j] - p.x[i], ry = p.y[j] - p.y[i], rz = p.z[j] - p.z[i];
+			float invDist = 1.0f / sqrtf(rx * rx + ry * ry + rz * rz + eps2);
+			float s = p.mass[j] * invDist * invDist * invDist;
+
+			accX += s * rx;
+			accY += s * ry;
+			accZ += s * rz;
+		}
+		ax[i] += G * accX;
+		ay[i] += G * accY;
+		az[i] += G * accZ;
+	}
+}
+
+void DirectSumSolver::computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	pool.parallelFor(p.size(), 64, [&](size_t begin, size_t end) {
+		std::fill(p.ax.begin() + begin, p.ax.begin() + end, 0.0f);
+		std::fill(p.ay.begin() + begin, p.ay.begin() + end, 0.0f);
+		std::fill(p.az.begin() + begin, p.az.begin() + end, 0.0f);
+
+		//Not tiled: every tile would round its partial sum into ax and lose the compensation
+		if (_compensated) {
+			compensatedDirectSumAccel(p.x.data() + begin, p.y.data() + begin, p.z.data() + begin, end - begin,
+				p.x.data(), p.y.data(), p.z.data(), p.mass.data(), p.size(),
+				G, eps2, p.ax.data() + begin, p.ay.data() + begin, p.az.data() + begin);
+			return;
+		}
+
+		if (_opLevel == 0) {
+			naiveDirectSumAccel(p, begin, end, G, eps2, p.ax.data(), p.ay.data(), p.az.data());
+			return;
+		}
+
+		tiledDirectSumAccel(p.x.data() + begin, p.y.data() + begin, p.z.data() + begin, end - begin,
+			p.x.data(), p.y.data(), p.z.data(), p.mass.data(), p.size(),
+			G, eps2, p.ax.data() + begin, p.ay.data() + begin, p.az.data() + begin,
+			_tileSize, _opLevel >= 2 ? _unroll : 1);
+	});
+}
+
+void DirectSumSolver::computeAccelerations(DoubleParticleArrays& p, double G, double eps2, ThreadPool& pool)
+{
+	pool.parallelFor(p.size(), 64, [&](size_t begin, size_t end) {
+		std::fill(p.ax.begin() + begin, p.ax.begin() + end, 0.0);
+		std::fill(p.ay.begin() + begin, p.ay.begin() + end, 0.0);
+		std::fill(p.az.begin() + begin, p.az.begin() + end, 0.0);
+
+		directSumAccel(p.x.data() + begin, p.y.data() + begin, p.z.data() + begin, end - begin,
+			p.x.data(), p.y.data(), p.z.data(), p.mass.data(), p.size(),
+			G, eps2, p.ax.data() + begin, p.ay.data() + begin, p.az.data() + begin);
+	});
+}
+
+//Gathers the targets of each thread into contiguous arrays, runs kernel on them against every particle and scatters the result
+template<typename Real, typename Kernel>
+static void subsetDirectSum(BasicParticleArrays<Real>& p, const std::vector<unsigned int>& targets, ThreadPool& pool, Kernel kernel)
+{
+	typedef typename BasicParticleArrays<Real>::Array Array;
+
+	pool.parallelFor(targets.size(), 64, [&](size_t begin, size_t end) {
+		size_t count = end - begin;
+		Array tx(count), ty(count), tz(count), ax(count, Real(0)), ay(count, Real(0)), az(count, Real(0));
+		for (size_t k = 0; k < count; ++k) {
+			unsigned int i = targets[begin + k];
+			tx[k] = p.x[i]; ty[k] = p.y[i]; tz[k] = p.z[i];
+		}
+
+		kernel(tx.data(), ty.data(), tz.data(), count, ax.data(), ay.data(), az.data());
+
+		for (size_t k = 0; k < count; ++k) {
+			unsigned int i = targets[begin + k];
+			p.ax[i] = ax[k]; p.ay[i] = ay[k]; p.az[i] = az[k];
+		}
+	});
+}
+
+void DirectSumSolver::computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2, ThreadPool& pool)
+{
+	subsetDirectSum(p, targets, pool, [&](const float* tx, const float* ty, const float* tz, size_t count, float* ax, float* ay, float* az) {
+		if (_compensated) {
+			compensatedDirectSumAccel(tx, ty, tz, count, p.x.data(), p.y.data(), p.z.data(), p.mass.data(), p.size(), G, eps2, ax, ay, az);
+		}
+		else {
+			tiledDirectSumAccel(tx, ty, tz, count, p.x.data(), p.y.data(), p.z.data(), p.mass.data(), p.size(), G, eps2, ax, ay, az,
+				_tileSize, _opLevel >= 2 ? _unroll : 1);
+		}
+	});
+}
+
+void DirectSumSolver::computeAccelerations(DoubleParticleArrays& p, const std::vector<unsigned int>& targets, double G, double eps2, ThreadPool& pool)
+{
+	subsetDirectSum(p, targets, pool, [&](const double* tx, const double* ty, const double* tz, size_t count, double* ax, double* ay, double* az) {
+		directSumAccel(tx, ty, tz, count, p.x.data(), p.y.data(), p.z.data(), p.mass.data(), p.size(), G, eps2, ax, ay, az);
+	});
+}
+
+//Acceleration and jerk of the targets [begin, end) in blocks of Width, V holding Width values of type Real
+template<typename V, size_t Width, typename Real>
+static void accelJerkRange(BasicParticleArrays<Real>& p, size_t begin, size_t end, Real G, Real eps2)
+{
+	size_t n = p.size();
+	V vEps2 = vset1(eps2);
+	V vThree = vset1(Real(3));
+	V vZero = vset1(Real(0));
+
+	for (size_t i = begin; i < end; i += Width) {
+		//Zero-padded copy of the block so the tail needs no special case
+		size_t count = std::min(Width, end - i);
+		Real b[6][Width] = {};
+		for (size_t k = 0; k < count; ++k) {
+			b[0][k] = p.x[i + k]; b[1][k] = p.y[i + k]; b[2][k] = p.z[i + k];
+			b[3][k] = p.vx[i + k]; b[4][k] = p.vy[i + k]; b[5][k] = p.vz[i + k];
+		}
+
+		V px = vload(b[0]), py = vload(b[1]), pz = vload(b[2]);
+		V pvx = vload(b[3]), pvy = vload(b[4]), pvz = vload(b[5]);
+		V accX = vZero, accY = vZero, accZ = vZero;
+		V jerkX = vZero, jerkY = vZero, jerkZ = vZero;
+
+		for (size_t j = 0; j < n; ++j) {
+			V rx = vsub(vset1(p.x[j]), px);
+			V ry = vsub(vset1(p.y[j]), py);
+			V rz = vsub(vset1(p.z[j]), pz);
+			V wx = vsub(vset1(p.vx[j]), pvx);
+			V wy = vsub(vset1(p.vy[j]), pvy);
+			V wz = vsub(vset1(p.vz[j]), pvz);
+
+			V distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+			V invDist = vrsqrt(distSqr);
+			V invDist2 = vmul(invDist, invDist);
+			V s = vmul(vset1(p.mass[j]), vmul(invDist, invDist2));
+			V rv = vmul(vThree, vmul(invDist2, vfmadd(rx, wx, vfmadd(ry, wy, vmul(rz, wz)))));
+
+			accX = vfmadd(s, rx, accX);
+			accY = vfmadd(s, ry, accY);
+			accZ = vfmadd(s, rz, accZ);
+			jerkX = vfmadd(s, vfnmadd(rv, rx, wx), jerkX);
+			jerkY = vfmadd(s, vfnmadd(rv, ry, wy), jerkY);
+			jerkZ = vfmadd(s, vfnmadd(rv, rz, wz), jerkZ);
+		}
+
+		V vG = vset1(G);
+		vstore(b[0], vmul(vG, accX)); vstore(b[1], vmul(vG, accY)); vstore(b[2], vmul(vG, accZ));
+		vstore(b[3], vmul(vG, jerkX)); vstore(b[4], vmul(vG, jerkY)); vstore(b[5], vmul(vG, jerkZ));
+		for (size_t k = 0; k < count; ++k) {
+			p.ax[i + k] = b[0][k]; p.ay[i + k] = b[1][k]; p.az[i + k] = b[2][k];
+			p.jx[i + k] = b[3][k]; p.jy[i + k] = b[4][k]; p.jz[i + k] = b[5][k];
+		}
+	}
+}
+
+void directSumAccelJerk(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	pool.parallelFor(p.size(), 64, [&](size_t begin, size_t end) {
+		accelJerkRange<vfloat, SIMD_WIDTH>(p, begin, end, G, eps2);
+	});
+}
+
+void directSumAccelJerk(DoubleParticleArrays& p, double G, double eps2, ThreadPool& pool)
+{
+	pool.parallelFor(p.size(), 64, [&](size_t begin, size_t end) {
+		accelJerkRange<vdouble, DSIMD_WIDTH>(p, begin, end, G, eps2);
+	});
+}
+
+//Pairs (i, j) for j in [jBegin, n): i gets m_j s r, j gets -m_i s r
+static void symmetricRow(const ParticleArrays& p, size_t i, size_t jBegin, size_t n, float eps2, float* bx, float* by, float* bz)
+{
+	float xi = p.x[i], yi = p.y[i], zi = p.z[i], mi = p.mass[i];
+	vfloat px = vset1(xi), py = vset1(yi), pz = vset1(zi), pm = vset1(mi);
+	vfloat vEps2 = vset1(eps2);
+	vfloat accX = vzero(), accY = vzero(), accZ = vzero();
+
+	size_t j = jBegin;
+	for (; j + SIMD_WIDTH <= n; j += SIMD_WIDTH) {
+		vfloat rx = vsub(vload(&p.x[j]), px);
+		vfloat ry = vsub(vload(&p.y[j]), py);
+		vfloat rz = vsub(vload(&p.z[j]), pz);
+
+		vfloat distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+		vfloat invDist = vrsqrt(distSqr);
+		vfloat s = vmul(invDist, vmul(invDist, invDist));
+
+		vfloat sj = vmul(s, vload(&p.mass[j]));
+		accX = vfmadd(sj, rx, accX);
+		accY = vfmadd(sj, ry, accY);
+		accZ = vfmadd(sj, rz, accZ);
+
+		vfloat si = vmul(s, pm);
+		vstore(bx + j, vfnmadd(si, rx, vload(bx + j)));
+		vstore(by + j, vfnmadd(si, ry, vload(by + j)));
+		vstore(bz + j, vfnmadd(si, rz, vload(bz + j)));
+	}
+
+	float ax = vhsum(accX), ay = vhsum(accY), az = vhsum(accZ);
+	for (; j < n; ++j) {
+		float rx = p.x[j] - xi, ry = p.y[j] - yi, rz = p.z[j] - zi;
+		float invDist = 1.0f / sqrtf(rx * rx + ry * ry + rz * rz + eps2);
+		float s = invDist * invDist * invDist;
+
+		ax += p.mass[j] * s * rx;
+		ay += p.mass[j] * s * ry;
+		az += p.mass[j] * s * rz;
+		bx[j] -= mi * s * rx;
+		by[j] -= mi * s * ry;
+		bz[j] -= mi * s * rz;
+	}
+
+	bx[i] += ax;
+	by[i] += ay;
+	bz[i] += az;
+}
+
+//ROWS consecutive rows at once so every j vector is loaded and its accumulators stored once for all of them
+static void symmetricRows(const ParticleArrays& p, size_t i, size_t n, float eps2, float* bx, float* by, float* bz)
+{
+	//Pairs inside the group of rows
+	for (size_t r = 0; r < ROWS - 1; ++r) {
+		symmetricRow(p, i + r, i + r + 1, i + ROWS, eps2, bx, by, bz);
+	}
+
+	vfloat vEps2 = vset1(eps2);
+	vfloat px[ROWS], py[ROWS], pz[ROWS], pm[ROWS];
+	vfloat accX[ROWS], accY[ROWS], accZ[ROWS];
+	for (size_t r = 0; r < ROWS; ++r) {
+		px[r] = vset1(p.x[i + r]);
+		py[r] = vset1(p.y[i + r]);
+		pz[r] = vset1(p.z[i + r]);
+		pm[r] = vset1(p.mass[i + r]);
+		accX[r] = accY[r] = accZ[r] = vzero();
+	}
+
+	size_t j = i + ROWS;
+	for (; j + SIMD_WIDTH <= n; j += SIMD_WIDTH) {
+		vfloat xj = vload(&p.x[j]), yj = vload(&p.y[j]), zj = vload(&p.z[j]), mj = vload(&p.mass[j]);
+		vfloat jx = vload(bx + j), jy = vload(by + j), jz = vload(bz + j);
+
+		for (size_t r = 0; r < ROWS; ++r) {
+			vfloat rx = vsub(xj, px[r]);
+			vfloat ry = vsub(yj, py[r]);
+			vfloat rz = vsub(zj, pz[r]);
+
+			vfloat distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+			vfloat invDist = vrsqrt(distSqr);
+			vfloat s = vmul(invDist, vmul(invDist, invDist));
+
+			vfloat sj = vmul(s, mj);
+			accX[r] = vfmadd(sj, rx, accX[r]);
+			accY[r] = vfmadd(sj, ry, accY[r]);
+			accZ[r] = vfmadd(sj, rz, accZ[r]);
+
+			vfloat si = vmul(s, pm[r]);
+			jx = vfnmadd(si, rx, jx);
+			jy = vfnmadd(si, ry, jy);
+			jz = vfnmadd(si, rz, jz);
+		}
+
+		vstore(bx + j, jx);
+		vstore(by + j, jy);
+		vstore(bz + j, jz);
+	}
+
+	for (size_t r = 0; r < ROWS; ++r) {
+		bx[i + r] += vhsum(accX[r]);
+		by[i + r] += vhsum(accY[r]);
+		bz[i + r] += vhsum(accZ[r]);
+
+		//Scalar tail, symmetricRow never enters its vector loop here
+		if (j < n) symmetricRow(p, i + r, j, n, eps2, bx, by, bz);
+	}
+}
+
+//Pairs (i, j) for j in [i + 1, n) in the precision of Real, V holding Width values, for the double and compensated evaluations.
+//Compensated rows Kahan-sum both the row and the contributions scattered to the j, the rounding errors being carried in cx, cy, cz.
+template<typename V, size_t Width, bool Compensated, typename Real>
+static void preciseSymmetricRow(const BasicParticleArrays<Real>& p, size_t i, size_t n, Real eps2,
+	Real* bx, Real* by, Real* bz, Real* cx, Real* cy, Real* cz)
+{
+	Real xi = p.x[i], yi = p.y[i], zi = p.z[i], mi = p.mass[i];
+	V px = vset1(xi), py = vset1(yi), pz = vset1(zi), pm = vset1(mi);
+	V vEps2 = vset1(eps2);
+	V vZero = vset1(Real(0));
+	V accX = vZero, accY = vZero, accZ = vZero;
+	V compX = vZero, compY = vZero, compZ = vZero;
+
+	size_t j = i + 1;
+	for (; j + Width <= n; j += Width) {
+		V rx = vsub(vload(&p.x[j]), px);
+		V ry = vsub(vload(&p.y[j]), py);
+		V rz = vsub(vload(&p.z[j]), pz);
+
+		V distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+		V invDist = vrsqrt(distSqr);
+		V s = vmul(invDist, vmul(invDist, invDist));
+
+		V sj = vmul(s, vload(&p.mass[j]));
+		V si = vsub(vZero, vmul(s, pm));
+		V jx = vload(bx + j), jy = vload(by + j), jz = vload(bz + j);
+
+		if (Compensated) {
+			compensatedAdd(vmul(sj, rx), accX, compX);
+			compensatedAdd(vmul(sj, ry), accY, compY);
+			compensatedAdd(vmul(sj, rz), accZ, compZ);
+
+			V jcx = vload(cx + j), jcy = vload(cy + j), jcz = vload(cz + j);
+			compensatedAdd(vmul(si, rx), jx, jcx);
+			compensatedAdd(vmul(si, ry), jy, jcy);
+			compensatedAdd(vmul(si, rz), jz, jcz);
+			vstore(cx + j, jcx);
+			vstore(cy + j, jcy);
+			vstore(cz + j, jcz);
+		}
+		else {
+			accX = vfmadd(sj, rx, accX);
+			accY = vfmadd(sj, ry, accY);
+			accZ = vfmadd(sj, rz, accZ);
+			jx = vfmadd(si, rx, jx);
+			jy = vfmadd(si, ry, jy);
+			jz = vfmadd(si, rz, jz);
+		}
+
+		vstore(bx + j, jx);
+		vstore(by + j, jy);
+		vstore(bz + j, jz);
+	}
+
+	Real lanes[3][Width];
+	vstore(lanes[0], vsub(accX, compX));
+	vstore(lanes[1], vsub(accY, compY));
+	vstore(lanes[2], vsub(accZ, compZ));
+	Real ax = 0, ay = 0, az = 0;
+	for (size_t k = 0; k < Width; ++k) {
+		ax += lanes[0][k];
+		ay += lanes[1][k];
+		az += lanes[2][k];
+	}
+
+	for (; j < n; ++j) {
+		Real rx = p.x[j] - xi, ry = p.y[j] - yi, rz = p.z[j] - zi;
+		Real invDist = Real(1) / std::sqrt(rx * rx + ry * ry + rz * rz + eps2);
+		Real s = invDist * invDist * invDist;
+
+		ax += p.mass[j] * s * rx;
+		ay += p.mass[j] * s * ry;
+		az += p.mass[j] * s * rz;
+		if (Compensated) {
+			scalarCompensatedAdd(-mi * s * rx, bx[j], cx[j]);
+			scalarCompensatedAdd(-mi * s * ry, by[j], cy[j]);
+			scalarCompensatedAdd(-mi * s * rz, bz[j], cz[j]);
+		}
+		else {
+			bx[j] -= mi * s * rx;
+			by[j] -= mi * s * ry;
+			bz[j] -= mi * s * rz;
+		}
+	}
+
+	if (Compensated) {
+		scalarCompensatedAdd(ax, bx[i], cx[i]);
+		scalarCompensatedAdd(ay, by[i], cy[i]);
+		scalarCompensatedAdd(az, bz[i], cz[i]);
+	}
+	else {
+		bx[i] += ax;
+		by[i] += ay;
+		bz[i] += az;
+	}
+}
+
+//Same traversal as SymmetricDirectSumSolver::computeAccelerations with preciseSymmetricRow. buffers holds, per thread, the sums then
+//the compensations of the three axes, the compensations staying empty when not Compensated. The reduction is done in double.
+template<typename V, size_t Width, bool Compensated, typename Real, typename Array>
+static void preciseSymmetricSum(BasicParticleArrays<Real>& p, double G, Real eps2, ThreadPool& pool, std::vector<Array>* buffers)
+{
+	size_t n = p.size();
+	for (unsigned int k = 0; k < 6; ++k) {
+		buffers[k].resize(pool.getThreadCount());
+	}
+
+	pool.run([&](unsigned int index, unsigned int count) {
+		Real* b[6];
+		for (unsigned int k = 0; k < 6; ++k) {
+			buffers[k][index].assign(k < 3 || Compensated ? n : 0, Real(0));
+			b[k] = buffers[k][index].data();
+		}
+
+		for (size_t block = index * ROW_BLOCK; block < n; block += count * ROW_BLOCK) {
+			for (size_t i = block; i < std::min(n, block + ROW_BLOCK); ++i) {
+				preciseSymmetricRow<V, Width, Compensated>(p, i, n, eps2, b[0], b[1], b[2], b[3], b[4], b[5]);
+			}
+		}
+
+		pool.barrier();
+
+		size_t begin, end;
+		ThreadPool::splitRange(n, index, count, 64, begin, end);
+		for (size_t i = begin; i < end; ++i) {
+			double a[3] = { 0.0, 0.0, 0.0 };
+			for (unsigned int t = 0; t < count; ++t) {
+				for (unsigned int k = 0; k < 3; ++k) {
+					a[k] += buffers[k][t][i];
+					if (Compensated) a[k] -= buffers[k + 3][t][i];
+				}
+			}
+			p.ax[i] = static_cast<Real>(G * a[0]);
+			p.ay[i] = static_cast<Real>(G * a[1]);
+			p.az[i] = static_cast<Real>(G * a[2]);
+		}
+	});
+}
+
+SymmetricDirectSumSolver::SymmetricDirectSumSolver()
+	: _compensated(false)
+{
+
+}
+
+void SymmetricDirectSumSolver::computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	if (_compensated) {
+		preciseSymmetricSum<vfloat, SIMD_WIDTH, true>(p, G, eps2, pool, _compensatedBuffers);
+		return;
+	}
+
+	size_t n = p.size();
+	unsigned int threadCount = pool.getThreadCount();
+	_threadAx.resize(threadCount);
+	_threadAy.resize(threadCount);
+	_threadAz.resize(threadCount);
+
+	pool.run([&](unsigned int index, unsigned int count) {
+		AlignedFloatArray& bx = _threadAx[index];
+		AlignedFloatArray& by = _threadAy[index];
+		AlignedFloatArray& bz = _threadAz[index];
+		bx.assign(n, 0.0f);
+		by.assign(n, 0.0f);
+		bz.assign(n, 0.0f);
+
+		for (size_t block = index * ROW_BLOCK; block < n; block += count * ROW_BLOCK) {
+			size_t blockEnd = std::min(n, block + ROW_BLOCK);
+			size_t i = block;
+			for (; i + ROWS <= blockEnd; i += ROWS) {
+				symmetricRows(p, i, n, eps2, bx.data(), by.data(), bz.data());
+			}
+			for (; i < blockEnd; ++i) {
+				symmetricRow(p, i, i + 1, n, eps2, bx.data(), by.data(), bz.data());
+			}
+		}
+
+		pool.barrier();
+
+		//Reduction of the per-thread buffers
+		size_t begin, end;
+		ThreadPool::splitRange(n, index, count, 64, begin, end);
+		for (size_t i = begin; i < end; ++i) {
+			float ax = 0.0f, ay = 0.0f, az = 0.0f;
+			for (unsigned int t = 0; t < count; ++t) {
+				ax += _threadAx[t][i];
+				ay += _threadAy[t][i];
+				az += _threadAz[t][i];
+			}
+			p.ax[i] = G * ax;
+			p.ay[i] = G * ay;
+			p.az[i] = G * az;
+		}
+	});
+}
+
+void SymmetricDirectSumSolver::computeAccelerations(DoubleParticleArrays& p, double G, double eps2, ThreadPool& pool)
+{
+	preciseSymmetricSum<vdouble, DSIMD_WIDTH, false>(p, G, eps2, pool, _doubleBuffers);
+}
+
+double directSumPotentialEnergy(const ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	size_t n = p.size();
+	std::vector<double> threadEnergy(pool.getThreadCount(), 0.0);
+
+	pool.run([&](unsigned int index, unsigned int count) {
+		vfloat vEps2 = vset1(eps2);
+		double energy = 0.0;
+
+		for (size_t block = index * ROW_BLOCK; block < n; block += count * ROW_BLOCK) {
+			for (size_t i = block; i < std::min(n, block + ROW_BLOCK); ++i) {
+				vfloat px = vset1(p.x[i]), py = vset1(p.y[i]), pz = vset1(p.z[i]);
+				vfloat acc = vzero();
+
+				size_t j = i + 1;
+				for (; j + SIMD_WIDTH <= n; j += SIMD_WIDTH) {
+					vfloat rx = vsub(vload(&p.x[j]), px);
+					vfloat ry = vsub(vload(&p.y[j]), py);
+					vfloat rz = vsub(vload(&p.z[j]), pz);
+					vfloat distSqr = vfmadd(rx, rx, vfmadd(ry, ry, vfmadd(rz, rz, vEps2)));
+					acc = vfmadd(vload(&p.mass[j]), vrsqrt(distSqr), acc);
+				}
+
+				double sum = vhsum(acc);
+				for (; j < n; ++j) {
+					float rx = p.x[j] - p.x[i], ry = p.y[j] - p.y[i], rz = p.z[j] - p.z[i];
+					sum += p.mass[j] / sqrt(rx * rx + ry * ry + rz * rz + eps2);
+				}
+
+				energy += p.mass[i] * sum;
+			}
+		}
+
+		threadEnergy[index] = energy;
+	});
+
+	double energy = 0.0;
+	for (unsigned int t = 0; t < threadEnergy.size(); ++t) {
+		energy += threadEnergy[t];
+	}
+	return -G * energy;
+}
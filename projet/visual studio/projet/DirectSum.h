@@ -0,0 +1,85 @@
+#ifndef DIRECTSUM_H
+#define DIRECTSUM_H
+
+#include <cstddef>
+#include <vector>
+
+#include "ForceSolver.h"
+
+//Adds to (ax, ay, az)[0, nTargets) the softened gravitational acceleration exerted on the targets (tx, ty, tz) by the sources (sx, sy, sz, sm).
+//The targets are processed SIMD_WIDTH at a time while the sources are broadcast one by one, so the accumulators never leave the registers.
+void directSumAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	float G, float eps2, float* ax, float* ay, float* az);
+
+//Accelerations and jerks (time derivatives of the accelerations) of every particle, used by the Hermite integrator.
+//Both come out of the same pair loop: jerk_i = G sum_j m_j (v_ij / r^3 - 3 (r_ij . v_ij) r_ij / r^5)
+void directSumAccelJerk(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+void directSumAccelJerk(DoubleParticleArrays& p, double G, double eps2, ThreadPool& pool);
+
+//Returns the potential energy -G sum_(i < j) m_i m_j / sqrt(r_ij^2 + eps2), each pair being evaluated once
+double directSumPotentialEnergy(const ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+
+//Same as directSumAccel but the sum over the sources is Kahan-compensated, so its rounding error no longer grows with nSources
+void compensatedDirectSumAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	float G, float eps2, float* ax, float* ay, float* az);
+
+//Double precision directSumAccel. The exact square root and division are used since there is no double rsqrt estimate before AVX-512.
+void directSumAccel(const double* tx, const double* ty, const double* tz, size_t nTargets,
+	const double* sx, const double* sy, const double* sz, const double* sm, size_t nSources,
+	double G, double eps2, double* ax, double* ay, double* az);
+
+//Same as directSumAccel but the sources are consumed by tiles of tileSize particles that stay in L1 while every target sweeps them,
+//and unroll (1, 2 or 4) vectors of targets share each broadcast source so the tile is read from cache once per unroll * SIMD_WIDTH targets
+void tiledDirectSumAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* sx, const float* sy, const float* sz, const float* sm, size_t nSources,
+	float G, float eps2, float* ax, float* ay, float* az, size_t tileSize, size_t unroll);
+
+//O(N^2) all-pairs solver.
+//The optimization level mirrors the GPU tiers: 0 = naive scalar loop, 1 = sources tiled in L1 (like sharedPositions),
+//2 = tiled + several target vectors per register block (like the unrolled shader).
+class DirectSumSolver : public ForceSolver
+{
+public:
+	DirectSumSolver();
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+	virtual void computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2, ThreadPool& pool);
+	//Double precision evaluation used by the double precision engine
+	void computeAccelerations(DoubleParticleArrays& p, double G, double eps2, ThreadPool& pool);
+	void computeAccelerations(DoubleParticleArrays& p, const std::vector<unsigned int>& targets, double G, double eps2, ThreadPool& pool);
+
+	void setOptimizationLevel(unsigned int level) { _opLevel = level; }
+	void setCompensatedSum(bool compensated) { _compensated = compensated; } //Kahan-compensated float sums, used by the mixed precision engine
+	void setTileSize(size_t tileSize) { _tileSize = tileSize > 0 ? tileSize : 1; } //Sources per tile, 1024 * 16 bytes fills half of a 32 KB L1
+	void setUnroll(size_t unroll) { _unroll = unroll >= 4 ? 4 : (unroll >= 2 ? 2 : 1); } //Target vectors per register block (1, 2 or 4)
+
+private:
+	unsigned int _opLevel;
+	bool _compensated;
+	size_t _tileSize;
+	size_t _unroll;
+};
+
+//All-pairs solver evaluating each pair once and applying equal and opposite contributions (Newton's third law).
+//Threads accumulate into private buffers which are reduced at the end, so no atomics are needed.
+class SymmetricDirectSumSolver : public ForceSolver
+{
+public:
+	SymmetricDirectSumSolver();
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+	//Double precision evaluation used by the double precision engine
+	void computeAccelerations(DoubleParticleArrays& p, double G, double eps2, ThreadPool& pool);
+
+	void setCompensatedSum(bool compensated) { _compensated = compensated; } //Kahan-compensated float sums, used by the mixed precision engine
+
+private:
+	bool _compensated;
+	std::vector<AlignedFloatArray> _threadAx, _threadAy, _threadAz;
+	std::vector<AlignedFloatArray> _compensatedBuffers[6]; //Per-thread sums then compensations of the compensated evaluation
+	std::vector<AlignedDoubleArray> _doubleBuffers[6];
+};
+
+#endif
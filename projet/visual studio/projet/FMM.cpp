@@ -0,0 +1,436 @@
+#include "FMM.h"
+#include "DirectSum.h"
+
+#include <algorithm>
+#include <cmath>
+
+static double binomial(unsigned int n, unsigned int k)
+{
+	double r = 1.0;
+	for (unsigned int i = 1; i <= k; ++i) {
+		r = r * (n - k + i) / i;
+	}
+	return r;
+}
+
+FMMSolver::FMMSolver()
+	: _order(0), _theta(0.5f), _leafSize(64)
+{
+	setOrder(4);
+}
+
+void FMMSolver::setOrder(unsigned int order)
+{
+	order = std::max(1u, std::min(order, 12u));
+	if (order == _order) return;
+
+	_order = order;
+	buildIndexTables();
+}
+
+void FMMSolver::buildIndexTables()
+{
+	unsigned int side = _order + 1;
+	_indexOf.assign(side * side * side, 0);
+	_mx.clear();
+	_my.clear();
+	_mz.clear();
+
+	for (unsigned int degree = 0; degree <= _order; ++degree) {
+		for (unsigned int x = degree + 1; x-- > 0;) {
+			for (unsigned int y = degree - x + 1; y-- > 0;) {
+				unsigned int z = degree - x - y;
+				_indexOf[(x * side + y) * side + z] = static_cast<unsigned int>(_mx.size());
+				_mx.push_back(x);
+				_my.push_back(y);
+				_mz.push_back(z);
+			}
+		}
+	}
+	_coefCount = static_cast<unsigned int>(_mx.size());
+
+	for (unsigned int axis = 0; axis < 3; ++axis) {
+		_minus1[axis].assign(_coefCount, -1);
+		_minus2[axis].assign(_coefCount, -1);
+	}
+
+	for (unsigned int k = 0; k < _coefCount; ++k) {
+		unsigned int m[3] = { _mx[k], _my[k], _mz[k] };
+		for (unsigned int axis = 0; axis < 3; ++axis) {
+			unsigned int d[3] = { m[0], m[1], m[2] };
+			if (m[axis] >= 1) {
+				d[axis] = m[axis] - 1;
+				_minus1[axis][k] = multiIndex(d[0], d[1], d[2]);
+			}
+			if (m[axis] >= 2) {
+				d[axis] = m[axis] - 2;
+				_minus2[axis][k] = multiIndex(d[0], d[1], d[2]);
+			}
+		}
+	}
+
+	_shiftTerms.clear();
+	_m2lTerms.clear();
+	for (unsigned int a = 0; a < _coefCount; ++a) {
+		for (unsigned int b = 0; b < _coefCount; ++b) {
+			if (_mx[b] <= _mx[a] && _my[b] <= _my[a] && _mz[b] <= _mz[a]) {
+				Term t;
+				t.a = a;
+				t.b = b;
+				t.c = multiIndex(_mx[a] - _mx[b], _my[a] - _my[b], _mz[a] - _mz[b]);
+				t.coef = binomial(_mx[a], _mx[b]) * binomial(_my[a], _my[b]) * binomial(_mz[a], _mz[b]);
+				_shiftTerms.push_back(t);
+			}
+
+			if (_mx[a] + _my[a] + _mz[a] + _mx[b] + _my[b] + _mz[b] <= _order) {
+				Term t;
+				t.a = a;
+				t.b = b;
+				t.c = multiIndex(_mx[a] + _mx[b], _my[a] + _my[b], _mz[a] + _mz[b]);
+				double sign = ((_mx[b] + _my[b] + _mz[b]) % 2 == 0) ? 1.0 : -1.0;
+				t.coef = sign * binomial(_mx[a] + _mx[b], _mx[a]) * binomial(_my[a] + _my[b], _my[a]) * binomial(_mz[a] + _mz[b], _mz[a]);
+				_m2lTerms.push_back(t);
+			}
+		}
+	}
+}
+
+//Monomials x^kx y^ky z^kz for every multi-index
+void FMMSolver::powers(double x, double y, double z, double* out) const
+{
+	double v[3] = { x, y, z };
+	out[0] = 1.0;
+	for (unsigned int k = 1; k < _coefCount; ++k) {
+		unsigned int axis = _mx[k] > 0 ? 0 : (_my[k] > 0 ? 1 : 2);
+		out[k] = out[_minus1[axis][k]] * v[axis];
+	}
+}
+
+//Taylor coefficients T_k = D^k f / k! of the softened kernel f(r) = 1 / sqrt(|r|^2 + eps2), from the recurrence
+//|k| s^2 T_k = -(2|k| - 1) sum_i r_i T_(k - e_i) - (|k| - 1) sum_i T_(k - 2e_i) with s^2 = |r|^2 + eps2
+void FMMSolver::derivatives(double x, double y, double z, double eps2, double* out) const
+{
+	double v[3] = { x, y, z };
+	double s2 = x * x + y * y + z * z + eps2;
+	double invS2 = 1.0 / s2;
+	out[0] = 1.0 / sqrt(s2);
+
+	for (unsigned int k = 1; k < _coefCount; ++k) {
+		unsigned int degree = _mx[k] + _my[k] + _mz[k];
+		double first = 0.0;
+		double second = 0.0;
+		for (unsigned int axis = 0; axis < 3; ++axis) {
+			if (_minus1[axis][k] >= 0) first += v[axis] * out[_minus1[axis][k]];
+			if (_minus2[axis][k] >= 0) second += out[_minus2[axis][k]];
+		}
+		out[k] = -((2.0 * degree - 1.0) * first + (degree - 1.0) * second) * invS2 / degree;
+	}
+}
+
+void FMMSolver::computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	_tree.build(p, _leafSize, pool);
+
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	size_t nodeCount = nodes.size();
+	if (nodeCount == 0) return;
+
+	//Levels and leaves. Parents always come before their children.
+	std::vector<unsigned int> depth(nodeCount, 0);
+	_parents.assign(nodeCount, 0);
+	_levels.clear();
+	_leaves.clear();
+	for (unsigned int i = 0; i < nodeCount; ++i) {
+		if (depth[i] >= _levels.size()) _levels.resize(depth[i] + 1);
+		_levels[depth[i]].push_back(i);
+
+		for (unsigned int c = nodes[i].firstChild; c < nodes[i].firstChild + nodes[i].childCount; ++c) {
+			depth[c] = depth[i] + 1;
+			_parents[c] = i;
+		}
+		if (nodes[i].childCount == 0) _leaves.push_back(i);
+	}
+
+	computeRadii(p);
+
+	_multipoles.assign(nodeCount * _coefCount, 0.0);
+	_locals.assign(nodeCount * _coefCount, 0.0);
+
+	//Interaction lists
+	_m2lLists.assign(nodeCount, std::vector<unsigned int>());
+	_p2pLists.assign(nodeCount, std::vector<unsigned int>());
+	traverse(0, 0);
+
+	//Upward pass: P2M on the leaves then M2M level by level
+	pool.parallelFor(_leaves.size(), 16, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) particleToMultipole(p, _leaves[i]);
+	});
+
+	for (size_t level = _levels.size(); level-- > 0;) {
+		const std::vector<unsigned int>& cells = _levels[level];
+		pool.parallelFor(cells.size(), 16, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				if (nodes[cells[i]].childCount > 0) multipoleToMultipole(cells[i]);
+			}
+		});
+	}
+
+	//M2L, each target cell is owned by a single thread
+	pool.parallelFor(nodeCount, 16, [&](size_t begin, size_t end) {
+		std::vector<double> scratch(_coefCount);
+		for (size_t i = begin; i < end; ++i) {
+			for (unsigned int s = 0; s < _m2lLists[i].size(); ++s) {
+				multipoleToLocal(static_cast<unsigned int>(i), _m2lLists[i][s], eps2, scratch.data());
+			}
+		}
+	});
+
+	//Downward pass
+	for (size_t level = 1; level < _levels.size(); ++level) {
+		const std::vector<unsigned int>& cells = _levels[level];
+		pool.parallelFor(cells.size(), 16, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) localToLocal(cells[i]);
+		});
+	}
+
+	//L2P and P2P on the leaves
+	pool.parallelFor(_leaves.size(), 4, [&](size_t begin, size_t end) {
+		std::vector<float> scratch;
+		for (size_t i = begin; i < end; ++i) {
+			localToParticles(p, _leaves[i], G);
+			particleToParticle(p, _leaves[i], G, eps2, scratch);
+		}
+	});
+}
+
+//Bounding radius of every cell around its expansion center, children first
+void FMMSolver::computeRadii(const ParticleArrays& p)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+	_radii.assign(nodes.size(), 0.0f);
+
+	for (size_t k = nodes.size(); k-- > 0;) {
+		const OctreeNode& cell = nodes[k];
+		float r2 = 0.0f;
+		float r = 0.0f;
+
+		if (cell.childCount == 0) {
+			for (unsigned int i = cell.begin; i < cell.end; ++i) {
+				unsigned int idx = indices[i];
+				glm::vec3 d = glm::vec3(p.x[idx], p.y[idx], p.z[idx]) - cell.center;
+				r2 = std::max(r2, d.x * d.x + d.y * d.y + d.z * d.z);
+			}
+			r = sqrtf(r2);
+		}
+		else {
+			for (unsigned int c = cell.firstChild; c < cell.firstChild + cell.childCount; ++c) {
+				glm::vec3 d = nodes[c].center - cell.center;
+				r = std::max(r, sqrtf(d.x * d.x + d.y * d.y + d.z * d.z) + _radii[c]);
+			}
+		}
+
+		_radii[k] = r;
+	}
+}
+
+bool FMMSolver::wellSeparated(unsigned int a, unsigned int b) const
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	glm::vec3 d = nodes[a].center - nodes[b].center;
+	float dist2 = d.x * d.x + d.y * d.y + d.z * d.z;
+	float radii = _radii[a] + _radii[b];
+	return radii * radii < _theta * _theta * dist2;
+}
+
+//Dual tree traversal: target cell a, source cell b
+void FMMSolver::traverse(unsigned int a, unsigned int b)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const OctreeNode& A = nodes[a];
+	const OctreeNode& B = nodes[b];
+
+	if (a == b) {
+		if (A.childCount == 0) {
+			_p2pLists[a].push_back(b);
+			return;
+		}
+		for (unsigned int i = A.firstChild; i < A.firstChild + A.childCount; ++i) {
+			for (unsigned int j = A.firstChild; j < A.firstChild + A.childCount; ++j) {
+				traverse(i, j);
+			}
+		}
+	}
+	else if (wellSeparated(a, b)) {
+		_m2lLists[a].push_back(b);
+	}
+	else if (A.childCount == 0 && B.childCount == 0) {
+		_p2pLists[a].push_back(b);
+	}
+	else if (B.childCount == 0 || (A.childCount > 0 && _radii[a] >= _radii[b])) {
+		for (unsigned int i = A.firstChild; i < A.firstChild + A.childCount; ++i) {
+			traverse(i, b);
+		}
+	}
+	else {
+		for (unsigned int j = B.firstChild; j < B.firstChild + B.childCount; ++j) {
+			traverse(a, j);
+		}
+	}
+}
+
+//M_k = sum_j m_j d_j^k with d_j the offset of particle j from the cell center
+void FMMSolver::particleToMultipole(const ParticleArrays& p, unsigned int node)
+{
+	const OctreeNode& cell = _tree.getNodes()[node];
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+	double* M = &_multipoles[node * _coefCount];
+
+	std::vector<double> pw(_coefCount);
+	for (unsigned int i = cell.begin; i < cell.end; ++i) {
+		unsigned int idx = indices[i];
+		powers(p.x[idx] - cell.center.x, p.y[idx] - cell.center.y, p.z[idx] - cell.center.z, pw.data());
+		for (unsigned int k = 0; k < _coefCount; ++k) {
+			M[k] += p.mass[idx] * pw[k];
+		}
+	}
+}
+
+//M^parent_k = sum_(l <= k) C(k, l) s^(k - l) M^child_l with s = child center - parent center
+void FMMSolver::multipoleToMultipole(unsigned int node)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const OctreeNode& cell = nodes[node];
+	double* M = &_multipoles[node * _coefCount];
+
+	std::vector<double> pw(_coefCount);
+	for (unsigned int c = cell.firstChild; c < cell.firstChild + cell.childCount; ++c) {
+		glm::vec3 s = nodes[c].center - cell.center;
+		powers(s.x, s.y, s.z, pw.data());
+		const double* childM = &_multipoles[c * _coefCount];
+
+		for (size_t t = 0; t < _shiftTerms.size(); ++t) {
+			const Term& term = _shiftTerms[t];
+			M[term.a] += term.coef * pw[term.c] * childM[term.b];
+		}
+	}
+}
+
+//L_n += sum_k (-1)^|k| C(n + k, n) M_k T_(n + k)(target center - source center)
+void FMMSolver::multipoleToLocal(unsigned int target, unsigned int source, double eps2, double* scratch)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	glm::vec3 r = nodes[target].center - nodes[source].center;
+	derivatives(r.x, r.y, r.z, eps2, scratch);
+
+	const double* M = &_multipoles[source * _coefCount];
+	double* L = &_locals[target * _coefCount];
+	for (size_t t = 0; t < _m2lTerms.size(); ++t) {
+		const Term& term = _m2lTerms[t];
+		L[term.a] += term.coef * M[term.b] * scratch[term.c];
+	}
+}
+
+//L^child_m += sum_(n >= m) C(n, m) L^parent_n t^(n - m) with t = child center - parent center
+void FMMSolver::localToLocal(unsigned int node)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const OctreeNode& cell = nodes[node];
+
+	unsigned int parent = _parents[node];
+	glm::vec3 t = cell.center - nodes[parent].center;
+	std::vector<double> pw(_coefCount);
+	powers(t.x, t.y, t.z, pw.data());
+
+	const double* parentL = &_locals[parent * _coefCount];
+	double* L = &_locals[node * _coefCount];
+	for (size_t k = 0; k < _shiftTerms.size(); ++k) {
+		const Term& term = _shiftTerms[k];
+		L[term.b] += term.coef * parentL[term.a] * pw[term.c];
+	}
+}
+
+//a = G sum_n L_n grad(e^n) with e the offset of the particle from the cell center
+void FMMSolver::localToParticles(ParticleArrays& p, unsigned int node, float G)
+{
+	const OctreeNode& cell = _tree.getNodes()[node];
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+	const double* L = &_locals[node * _coefCount];
+
+	std::vector<double> pw(_coefCount);
+	for (unsigned int i = cell.begin; i < cell.end; ++i) {
+		unsigned int idx = indices[i];
+		powers(p.x[idx] - cell.center.x, p.y[idx] - cell.center.y, p.z[idx] - cell.center.z, pw.data());
+
+		double a[3] = { 0.0, 0.0, 0.0 };
+		for (unsigned int n = 1; n < _coefCount; ++n) {
+			unsigned int m[3] = { _mx[n], _my[n], _mz[n] };
+			for (unsigned int axis = 0; axis < 3; ++axis) {
+				if (m[axis] > 0) a[axis] += L[n] * m[axis] * pw[_minus1[axis][n]];
+			}
+		}
+
+		p.ax[idx] = static_cast<float>(G * a[0]);
+		p.ay[idx] = static_cast<float>(G * a[1]);
+		p.az[idx] = static_cast<float>(G * a[2]);
+	}
+}
+
+//Direct sum between the particles of a target leaf and all its neighbor leaves
+void FMMSolver::particleToParticle(ParticleArrays& p, unsigned int target, float G, float eps2, std::vector<float>& scratch)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+	const OctreeNode& cell = nodes[target];
+	const std::vector<unsigned int>& sources = _p2pLists[target];
+
+	size_t sourceCount = 0;
+	for (unsigned int s = 0; s < sources.size(); ++s) {
+		sourceCount += nodes[sources[s]].end - nodes[sources[s]].begin;
+	}
+	size_t targetCount = cell.end - cell.begin;
+
+	//Layout: sx, sy, sz, sm, tx, ty, tz, ax, ay, az
+	scratch.resize(4 * sourceCount + 6 * targetCount);
+	float* sx = scratch.data();
+	float* sy = sx + sourceCount;
+	float* sz = sy + sourceCount;
+	float* sm = sz + sourceCount;
+	float* tx = sm + sourceCount;
+	float* ty = tx + targetCount;
+	float* tz = ty + targetCount;
+	float* ax = tz + targetCount;
+	float* ay = ax + targetCount;
+	float* az = ay + targetCount;
+
+	size_t k = 0;
+	for (unsigned int s = 0; s < sources.size(); ++s) {
+		const OctreeNode& source = nodes[sources[s]];
+		for (unsigned int i = source.begin; i < source.end; ++i, ++k) {
+			unsigned int idx = indices[i];
+			sx[k] = p.x[idx];
+			sy[k] = p.y[idx];
+			sz[k] = p.z[idx];
+			sm[k] = p.mass[idx];
+		}
+	}
+
+	for (unsigned int i = 0; i < targetCount; ++i) {
+		unsigned int idx = indices[cell.begin + i];
+		tx[i] = p.x[idx];
+		ty[i] = p.y[idx];
+		tz[i] = p.z[idx];
+		ax[i] = p.ax[idx];
+		ay[i] = p.ay[idx];
+		az[i] = p.az[idx];
+	}
+
+	directSumAccel(tx, ty, tz, targetCount, sx, sy, sz, sm, sourceCount, G, eps2, ax, ay, az);
+
+	for (unsigned int i = 0; i < targetCount; ++i) {
+		unsigned int idx = indices[cell.begin + i];
+		p.ax[idx] = ax[i];
+		p.ay[idx] = ay[i];
+		p.az[idx] = az[i];
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <vector>
+
+#include "ForceSolver.h"
+#include "Octree.h"
+
+//Fast multipole solver using cartesian Taylor expansions of the softened kernel 1 / sqrt(r^2 + eps2) up to order p.
+//Cell pairs are found with a dual tree traversal: pairs with (rA + rB) < theta * d interact through M2L,
+//the remaining close leaf pairs are summed directly with the SIMD kernel.
+//
+//Accuracy / order trade-off: the truncation error decreases roughly like theta^(p + 1) while the M2L cost grows like p^6.
+//Mean relative force errors measured on a centrally concentrated 20k particle sphere with theta = 0.5:
+//p = 2: 3e-2, p = 3: 6e-3, p = 4: 1.5e-3, p = 6: 1.5e-4, p = 8: 2e-5.
+//The solver only beats Barnes-Hut for large N (> 100k) at p <= 4. Float particle data limits useful orders to about 8.
+class FMMSolver : public ForceSolver
+{
+public:
+	FMMSolver();
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+
+	void setOrder(unsigned int order);
+	unsigned int getOrder() const { return _order; }
+	void setTheta(float theta) { _theta = theta; }
+	void setLeafSize(unsigned int leafSize) { _leafSize = leafSize; }
+
+private:
+	struct Term
+	{
+		unsigned int a, b, c; //Multi-index indices
+		double coef;
+	};
+
+	void buildIndexTables();
+	unsigned int multiIndex(unsigned int x, unsigned int y, unsigned int z) const { return _indexOf[(x * (_order + 1) + y) * (_order + 1) + z]; }
+	void powers(double x, double y, double z, double* out) const;
+	void derivatives(double x, double y, double z, double eps2, double* out) const;
+
+	void traverse(unsigned int a, unsigned int b);
+	bool wellSeparated(unsigned int a, unsigned int b) const;
+	void computeRadii(const ParticleArrays& p);
+
+	void particleToMultipole(const ParticleArrays& p, unsigned int node);
+	void multipoleToMultipole(unsigned int node);
+	void multipoleToLocal(unsigned int target, unsigned int source, double eps2, double* scratch);
+	void localToLocal(unsigned int node);
+	void localToParticles(ParticleArrays& p, unsigned int node, float G);
+	void particleToParticle(ParticleArrays& p, unsigned int target, float G, float eps2, std::vector<float>& scratch);
+
+	Octree _tree;
+	unsigned int _order;
+	float _theta;
+	unsigned int _leafSize;
+
+	//Multi-indices (x, y, z) with x + y + z <= order, sorted by degree
+	unsigned int _coefCount;
+	std::vector<unsigned int> _mx, _my, _mz;
+	std::vector<unsigned int> _indexOf;
+	std::vector<int> _minus1[3]; //Index of k - e_i, -1 when k_i = 0
+	std::vector<int> _minus2[3]; //Index of k - 2e_i, -1 when k_i < 2
+	std::vector<Term> _shiftTerms; //(a, b, a - b, C(a, b)) for b <= a, used by M2M and L2L
+	std::vector<Term> _m2lTerms; //(n, k, n + k, (-1)^|k| C(n + k, n))
+
+	std::vector<double> _multipoles; //_coefCount per node
+	std::vector<double> _locals;
+	std::vector<std::vector<unsigned int>> _levels; //Node indices by depth
+	std::vector<unsigned int> _parents;
+	std::vector<float> _radii; //Distance from the cell center to its farthest particle
+	std::vector<std::vector<unsigned int>> _m2lLists; //Source cells of every target cell
+	std::vector<std::vector<unsigned int>> _p2pLists; //Source leaves of every target leaf
+	std::vector<unsigned int> _leaves;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef FORCESOLVER_H
+#define FORCESOLVER_H
+
+#include <vector>
+
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+
+//Interface of the CPU gravity solvers.
+//A solver reads the positions and masses of p and writes the acceleration of every particle into p.ax/ay/az.
+class ForceSolver
+{
+public:
+	virtual ~ForceSolver() {}
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool) = 0;
+
+	//Computes the accelerations of the particles listed in targets, the sources still being all the particles.
+	//Used by the block time steps. The accelerations of the other particles may be overwritten.
+	//Solvers without a cheaper path evaluate every particle.
+	virtual void computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& /*targets*/, float G, float eps2, ThreadPool& pool)
+	{
+		computeAccelerations(p, G, eps2, pool);
+	}
+
+	//Called when the particles were permuted or replaced, for the solvers keeping data between evaluations
+	virtual void invalidate() {}
+};
+
+#endif
@@ -1,35 +1,107 @@
 #ifndef GPUBUFFER_H
 #define GPUBUFFER_H
 
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include <GL/glew.h>
 #include <GL/glut.h>
 
+//Buffer of T on the GPU. The storage is immutable (glBufferStorage) when the driver supports it and only reallocated when the
+//data outgrows the capacity, the size being the number of elements in use. Indexed targets are bound to the used range so
+//that length() in the shaders is the size. A mapped buffer stays persistently and coherently mapped, its writes and reads
+//being plain copies once the GPU commands issued before are done.
 template<typename T>
 class GPUBuffer
 {
 public:
-	GPUBuffer(GLenum target, GLenum usage, int binding = 0)
-		:_target(target), _usage(usage), _binding(binding)
+	GPUBuffer(GLenum target, GLenum usage, int binding = 0, bool mapped = false)
+		:_target(target), _usage(usage), _binding(binding), _bufferSize(0), _capacity(0), _mapped(mapped), _data(nullptr)
 	{
 		glGenBuffers(1, &_bufferId);
-		if (target == GL_SHADER_STORAGE_BUFFER || target == GL_UNIFORM_BUFFER || target == GL_TRANSFORM_FEEDBACK_BUFFER || target == GL_ATOMIC_COUNTER_BUFFER) {
+		if (isIndexed()) {
 			glBindBufferBase(target, binding, _bufferId);
 		}
 	}
 
 	//Sends data to the gpu buffer
-	void setData(std::vector<T>& data)
+	void setData(const std::vector<T>& data)
 	{
-		glBindBuffer(_target, _bufferId);
-		glBufferData(_target, sizeof(T) * data.size(), static_cast<void*>(data.data()), _usage);
-		_bufferSize = data.size();
+		resize(data.size(), false);
+		setSubData(0, data.data(), data.size());
+	}
+
+	//Changes the number of elements in use, the new ones being undefined
+	void resize(size_t size, bool keepData = true)
+	{
+		if (size > _capacity) {
+			reserve(std::max(size, _capacity + _capacity / 2), keepData);
+		}
+		_bufferSize = size;
+		bindRange();
+	}
+
+	//Writes count elements at offset, offset + count being at most the size
+	void setSubData(size_t offset, const T* values, size_t count)
+	{
+		if (count == 0) return;
+
+		if (_data) {
+			waitForGPU();
+			memcpy(_data + offset, values, sizeof(T) * count);
+		}
+		else {
+			glBindBuffer(_target, _bufferId);
+			glBufferSubData(_target, sizeof(T) * offset, sizeof(T) * count, static_cast<const void*>(values));
+		}
 	}
 
 	//Gets data from the gpu buffer
 	void getData(std::vector<T>& data)
 	{
 		data.resize(_bufferSize);
+		if (_bufferSize == 0) return;
+
+		if (_data) {
+			glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+			waitForGPU();
+			memcpy(data.data(), _data, sizeof(T) * _bufferSize);
+		}
+		else {
+			glBindBuffer(_target, _bufferId);
+			glGetBufferSubData(_target, 0, sizeof(T) * data.size(), static_cast<void*>(data.data()));
+		}
+	}
+
+	//Allocates room for capacity elements, keeping the current data. Never shrinks.
+	void reserve(size_t capacity, bool keepData = true)
+	{
+		if (capacity <= _capacity) return;
+
+		GLuint oldId = _bufferId;
+		glGenBuffers(1, &_bufferId);
 		glBindBuffer(_target, _bufferId);
-		glGetBufferSubData(_target, 0, sizeof(T) * data.size(), static_cast<void*>(data.data()));
+
+		if (GLEW_ARB_buffer_storage) {
+			GLbitfield access = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(_target, sizeof(T) * capacity, nullptr, GL_DYNAMIC_STORAGE_BIT | (_mapped ? access : 0));
+			_data = _mapped ? static_cast<T*>(glMapBufferRange(_target, 0, sizeof(T) * capacity, access)) : nullptr;
+		}
+		else {
+			glBufferData(_target, sizeof(T) * capacity, nullptr, _usage);
+			_data = nullptr;
+		}
+
+		if (keepData && _bufferSize > 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, oldId);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, _bufferId);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(T) * _bufferSize);
+		}
+		glDeleteBuffers(1, &oldId); //Also unmaps it
+
+		_capacity = capacity;
+		bindRange();
 	}
 
 	void bind() const
@@ -37,12 +109,70 @@ public:
 		glBindBuffer(_target, _bufferId);
 	}
 
+	//Attaches the buffer to another indexed binding point, to swap buffers between dispatches
+	void bindBase(int binding)
+	{
+		_binding = binding;
+		bindRange();
+	}
+
+	//Queues a copy of the data on the GPU into destination from its element offset, destination being large enough
+	void copyTo(GPUBuffer<T>& destination, size_t offset) const
+	{
+		if (_bufferSize == 0) return;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, _bufferId);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, destination._bufferId);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, sizeof(T) * offset, sizeof(T) * _bufferSize);
+	}
+
+	//Replaces the data by a copy of source made on the GPU
+	void copyFrom(const GPUBuffer<T>& source)
+	{
+		resize(source.size(), false);
+		source.copyTo(*this, 0);
+	}
+
+	//Persistently mapped storage, nullptr when the buffer is not mapped. Wait for the GPU before touching it.
+	T* data() { return _data; }
+
+	//Blocks until the GPU has executed the commands issued so far
+	void waitForGPU() const
+	{
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+	}
+
+	size_t size() const { return _bufferSize; }
+	size_t capacity() const { return _capacity; }
+
 private:
+	bool isIndexed() const
+	{
+		return _target == GL_SHADER_STORAGE_BUFFER || _target == GL_UNIFORM_BUFFER || _target == GL_TRANSFORM_FEEDBACK_BUFFER || _target == GL_ATOMIC_COUNTER_BUFFER;
+	}
+
+	void bindRange() const
+	{
+		if (!isIndexed()) return;
+
+		if (_bufferSize > 0) {
+			glBindBufferRange(_target, _binding, _bufferId, 0, sizeof(T) * _bufferSize);
+		}
+		else {
+			glBindBufferBase(_target, _binding, _bufferId);
+		}
+	}
+
 	GLenum _target;
-	GLenum _usage;
+	GLenum _usage; //Only used by drivers without immutable storage
 	int _binding;
 	GLuint _bufferId;
 	size_t _bufferSize;
+	size_t _capacity;
+	bool _mapped;
+	T* _data;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,78 @@
+#include "GPUReadback.h"
+
+void GPUReadback::request(const std::vector<const GPUBuffer<float>*>& buffers, const Callback& callback)
+{
+	Request request;
+	request.callback = callback;
+
+	if (_freeStaging.empty()) {
+		_freeStaging.push_back(_stagingBuffers.size());
+		_stagingBuffers.push_back(GPUBuffer<float>(GL_COPY_WRITE_BUFFER, GL_STREAM_READ, 0, true));
+	}
+	request.staging = _freeStaging.back();
+	_freeStaging.pop_back();
+
+	size_t total = 0;
+	for (const GPUBuffer<float>* buffer : buffers) {
+		request.sizes.push_back(buffer->size());
+		total += buffer->size();
+	}
+
+	GPUBuffer<float>& staging = _stagingBuffers[request.staging];
+	staging.resize(total, false);
+
+	//The copies see the writes of the shaders dispatched before
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	size_t offset = 0;
+	for (const GPUBuffer<float>* buffer : buffers) {
+		buffer->copyTo(staging, offset);
+		offset += buffer->size();
+	}
+
+	request.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush(); //So the fence gets signaled without anyone waiting on it
+	_requests.push_back(request);
+}
+
+void GPUReadback::poll()
+{
+	while (!_requests.empty()) {
+		GLenum status = glClientWaitSync(_requests.front().fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+		complete();
+	}
+}
+
+void GPUReadback::finish()
+{
+	while (!_requests.empty()) {
+		while (glClientWaitSync(_requests.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		complete();
+	}
+}
+
+//Hands the data of the first request, whose fence is signaled, to its callback
+void GPUReadback::complete()
+{
+	Request request = _requests.front();
+	_requests.pop_front();
+	glDeleteSync(request.fence);
+
+	GPUBuffer<float>& staging = _stagingBuffers[request.staging];
+	std::vector<float> all;
+	const float* source = staging.data();
+	if (!source) { //No persistent mapping, the copy being done this does not stall either
+		staging.getData(all);
+		source = all.data();
+	}
+
+	std::vector<std::vector<float>> data(request.sizes.size());
+	for (unsigned int i = 0; i < request.sizes.size(); ++i) {
+		data[i].assign(source, source + request.sizes[i]);
+		source += request.sizes[i];
+	}
+	_freeStaging.push_back(request.staging);
+
+	//Last, the callback being free to make new requests
+	request.callback(data);
+}
@@ -0,0 +1,39 @@
+#ifndef GPUREADBACK_H
+#define GPUREADBACK_H
+
+#include "GPUBuffer.h"
+
+#include <vector>
+#include <deque>
+#include <functional>
+
+//Reads GPU buffers back without stalling. request() queues copies of the buffers into a staging buffer followed by a fence,
+//and poll() hands the copies to the callback of the request once the fence is signaled, the GPU and the caller having kept
+//working meanwhile. Callbacks are called in the order of the requests, from poll() or finish().
+class GPUReadback
+{
+public:
+	typedef std::function<void(std::vector<std::vector<float>>&)> Callback; //Called with one vector per requested buffer
+
+	void request(const std::vector<const GPUBuffer<float>*>& buffers, const Callback& callback);
+	void poll(); //Calls the callbacks of the finished requests
+	void finish(); //Waits for all the requests and calls their callbacks
+	bool isPending() const { return !_requests.empty(); }
+
+private:
+	struct Request
+	{
+		unsigned int staging; //Index in _stagingBuffers
+		std::vector<size_t> sizes;
+		GLsync fence;
+		Callback callback;
+	};
+
+	void complete();
+
+	std::deque<Request> _requests;
+	std::vector<GPUBuffer<float>> _stagingBuffers; //Mapped, reused by the next requests once their data was handed over
+	std::vector<unsigned int> _freeStaging;
+};
+
+#endif
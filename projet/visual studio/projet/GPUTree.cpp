@@ -0,0 +1,130 @@
+#include "GPUTree.h"
+
+#include <vector>
+#include <algorithm>
+
+static const unsigned int BUILD_GROUP_SIZE = 256; //Work group sizes of the shaders
+static const unsigned int WALK_GROUP_SIZE = 128;
+static const unsigned int RADIX_BITS = 4;
+static const unsigned int KEY_BITS = 30;
+static const unsigned int NODE_FLOATS = 16;
+
+GPUTree::GPUTree()
+	: _infoBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW, 7), _keyBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 8),
+	_valueBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 9), _keyTmpBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 10),
+	_valueTmpBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 11), _histogramBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 12),
+	_nodeBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 13), _flagBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, 14),
+	_count(0), _stage(0), _shift(0), _theta(0.5f), _kick(0.0f)
+{
+
+}
+
+void GPUTree::loadPrograms(const float* G, const float* dt, const float* eps2)
+{
+	_buildProgram.loadShader(GL_COMPUTE_SHADER, "shaders/tree_build.cs");
+	_buildProgram.finalize();
+	_buildProgram.registerUniform("count", &_count);
+	_buildProgram.registerUniform("stage", &_stage);
+	_buildProgram.registerUniform("theta", &_theta);
+
+	_sortProgram.loadShader(GL_COMPUTE_SHADER, "shaders/radix_sort.cs");
+	_sortProgram.finalize();
+	_sortProgram.registerUniform("count", &_count);
+	_sortProgram.registerUniform("stage", &_stage);
+	_sortProgram.registerUniform("shift", &_shift);
+
+	_walkProgram.loadShader(GL_COMPUTE_SHADER, "shaders/tree_walk.cs");
+	_walkProgram.finalize();
+	_walkProgram.registerUniform("count", &_count);
+	_walkProgram.registerUniform("kick", &_kick);
+	_walkProgram.registerUniform("G", G);
+	_walkProgram.registerUniform("dt", dt);
+	_walkProgram.registerUniform("EPS2", eps2);
+}
+
+void GPUTree::computeAccelerations(unsigned int count, float kick)
+{
+	if (count == 0) return;
+
+	sortParticles(count);
+
+	//Internal nodes, escape links of all the nodes, then moments
+	_stage = 2;
+	dispatch(_buildProgram, _count - 1, BUILD_GROUP_SIZE);
+	_stage = 3;
+	dispatch(_buildProgram, 2 * _count - 1, BUILD_GROUP_SIZE);
+	_stage = 4;
+	dispatch(_buildProgram, _count, BUILD_GROUP_SIZE);
+
+	_kick = kick;
+	dispatch(_walkProgram, _count, WALK_GROUP_SIZE);
+}
+
+void GPUTree::sortParticles(unsigned int count)
+{
+	if (count == 0) return;
+
+	resize(count);
+
+	//Empty box, lowered and raised by the atomics of stage 0
+	std::vector<unsigned int> info{ 0xffffffff, 0xffffffff, 0xffffffff, 0, 0, 0 };
+	_infoBuffer.setData(info);
+
+	for (_stage = 0; _stage < 2; ++_stage) { //Bounding box then keys
+		dispatch(_buildProgram, _count, BUILD_GROUP_SIZE);
+	}
+
+	sortKeys();
+}
+
+//Every buffer is entirely written by the shaders before being read, so nothing is uploaded and the storage is only
+//reallocated when the particles outgrow it
+void GPUTree::resize(unsigned int count)
+{
+	if (count == _count) return;
+
+	_count = count;
+	unsigned int tiles = (count + BUILD_GROUP_SIZE - 1) / BUILD_GROUP_SIZE;
+
+	_keyBuffer.resize(count, false);
+	_valueBuffer.resize(count, false);
+	_keyTmpBuffer.resize(count, false);
+	_valueTmpBuffer.resize(count, false);
+	_histogramBuffer.resize(tiles << RADIX_BITS, false);
+	_nodeBuffer.resize((2 * count - 1) * NODE_FLOATS, false);
+	_flagBuffer.resize(count, false);
+}
+
+//LSD radix sort of the keys and their particle indices, the buffers swapping bindings after every pass.
+//The number of passes being even, the result ends in _keyBuffer and _valueBuffer with their original bindings.
+void GPUTree::sortKeys()
+{
+	GPUBuffer<unsigned int>* keysIn = &_keyBuffer;
+	GPUBuffer<unsigned int>* valuesIn = &_valueBuffer;
+	GPUBuffer<unsigned int>* keysOut = &_keyTmpBuffer;
+	GPUBuffer<unsigned int>* valuesOut = &_valueTmpBuffer;
+
+	for (_shift = 0; _shift < KEY_BITS; _shift += RADIX_BITS) {
+		_stage = 0; //Count
+		dispatch(_sortProgram, _count, BUILD_GROUP_SIZE);
+		_stage = 1; //Scan
+		dispatch(_sortProgram, 1, BUILD_GROUP_SIZE);
+		_stage = 2; //Scatter
+		dispatch(_sortProgram, _count, BUILD_GROUP_SIZE);
+
+		std::swap(keysIn, keysOut);
+		std::swap(valuesIn, valuesOut);
+		keysIn->bindBase(8);
+		valuesIn->bindBase(9);
+		keysOut->bindBase(10);
+		valuesOut->bindBase(11);
+	}
+}
+
+//Dispatches enough work groups for invocations invocations, each dispatch waiting for the writes of the previous one
+void GPUTree::dispatch(ShaderProg& program, unsigned int invocations, unsigned int groupSize)
+{
+	program.bind();
+	glDispatchCompute((invocations + groupSize - 1) / groupSize, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
@@ -0,0 +1,55 @@
+#ifndef GPUTREE_H
+#define GPUTREE_H
+
+#include "ShaderProg.h"
+#include "GPUBuffer.h"
+
+//Barnes-Hut solver of the GPU, built from compute shaders every evaluation: bounding box reduction and 30-bit Morton keys,
+//LSD radix sort of the keys, binary radix tree over the sorted keys (Karras 2012), boxes and monopoles accumulated from the leaves
+//up, then a stackless walk per particle. It reads the position buffer (binding 0) and writes the acceleration buffer (binding 2),
+//its own buffers using the bindings 7 to 14.
+class GPUTree
+{
+public:
+	GPUTree();
+
+	//Compiles the programs, their G, dt and EPS2 uniforms pointing to the given values
+	void loadPrograms(const float* G, const float* dt, const float* eps2);
+
+	//Accelerations of the count first particles of the position buffer. When kick is not 0 the speeds (binding 1) are also
+	//incremented by kick * dt * acceleration.
+	void computeAccelerations(unsigned int count, float kick);
+	//Sorts the count first particles of the position buffer along their Morton keys, the value buffer (binding 9) then listing
+	//the particle of every sorted slot
+	void sortParticles(unsigned int count);
+
+	void setTheta(float theta) { _theta = theta; }
+	float getTheta() const { return _theta; }
+
+private:
+	void resize(unsigned int count);
+	void sortKeys();
+	void dispatch(ShaderProg& program, unsigned int invocations, unsigned int groupSize);
+
+	ShaderProg _buildProgram;
+	ShaderProg _sortProgram;
+	ShaderProg _walkProgram;
+
+	GPUBuffer<unsigned int> _infoBuffer; //Bounding box of the particles
+	GPUBuffer<unsigned int> _keyBuffer; //Morton keys and particle indices, sorted along the keys
+	GPUBuffer<unsigned int> _valueBuffer;
+	GPUBuffer<unsigned int> _keyTmpBuffer; //Other half of the radix sort ping-pong
+	GPUBuffer<unsigned int> _valueTmpBuffer;
+	GPUBuffer<unsigned int> _histogramBuffer; //Digit counts of every tile of the radix sort
+	GPUBuffer<float> _nodeBuffer; //2 * count - 1 nodes of 16 floats
+	GPUBuffer<unsigned int> _flagBuffer; //Children done of every internal node
+
+	//Uniforms
+	unsigned int _count;
+	unsigned int _stage;
+	unsigned int _shift;
+	float _theta;
+	float _kick;
+};
+
+#endif
@@ -1,15 +1,36 @@
 #include "GravitySimulation.h"
 #include "Timer.h"
+#include "Hash.h"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+
+static const unsigned int REORDER_GROUP_SIZE = 256; //Work group size of shaders/reorder.cs
 
 GravitySimulation::GravitySimulation()
-	: _onGPU(true), _paused(true), _initialTick(true), _dt(0.01f), _G(1.0f), _eps2(0.1f), _positionBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 0), 
-	_speedBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 1), _vao(GL_ARRAY_BUFFER, GL_STATIC_DRAW), _currentComputeProgramIndex(7), _opLevel(1),
-	_opacity(0.1f)
+	: _particleCount(0), _onGPU(true), _paused(true), _initialTick(true), _leavingGPU(false), _switchGeneration(0), _tickCount(0), _energyInterval(0),
+	_snapshotInterval(0), _currentComputeProgramIndex(7), _maxGroupCount(65535), _initialHash(0), _initialAccelerationsReady(false),
+	_accelerationG(0.0f), _accelerationEps2(0.0f), _halfStepReady(false), _halfStepDt(0.0f), _hermiteStage(0), _GPUHermiteReady(false),
+	_stageCoefficient(1.0f), _kickStage(0), _adaptiveStage(0), _GPUTimeStep(0.0f), _GPUForcesReady(false), _GPUCriterion(0.0),
+	_GPUSolver(GPU_DIRECT_SUM), _positionBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 0), _speedBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 1),
+	_nextPositionBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 15), _nextSpeedBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 16),
+	_initialPositionBuffer(GL_COPY_READ_BUFFER, GL_STATIC_COPY), _initialSpeedBuffer(GL_COPY_READ_BUFFER, GL_STATIC_COPY),
+	_halfStepSpeedBuffer(GL_COPY_READ_BUFFER, GL_STATIC_COPY), _initialAccelerationBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 17),
+	_accelerationBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 2), _jerkBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 3),
+	_predictedPositionBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 4), _predictedSpeedBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 5),
+	_criterionBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_READ, 6, true), _savedPositionBuffer(GL_COPY_READ_BUFFER, GL_STATIC_COPY),
+	_savedSpeedBuffer(GL_COPY_READ_BUFFER, GL_STATIC_COPY), _savedAccelerationBuffer(GL_COPY_READ_BUFFER, GL_STATIC_COPY),
+	_idBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 18), _nextIdBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, 19), _vao(GL_ARRAY_BUFFER, GL_STATIC_DRAW), _dt(0.01f), _G(1.0f), _eps2(0.1f),
+	_opLevel(1), _opacity(0.1f), _reorderInterval(100), _GPUTicksSinceReorder(0)
 {
+	_CPUEngine.setOptimizationLevel(_opLevel);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &_maxGroupCount);
+
 	std::vector<float> vertex { 0.0f, 0.0f, 0.0f };
 	_vao.setData(vertex);
 
@@ -29,7 +50,7 @@ void GravitySimulation::loadDataset(const std::string& filename)
 
 	std::cout << "Loading dataset... ";
 
-	_initialParticles.clear();
+	ParticleState particles;
 
 	std::string line;
 	while (getline(file, line)) {
@@ -41,12 +62,12 @@ void GravitySimulation::loadDataset(const std::string& filename)
 
 		Particle p;
 		iss >> p.mass >> p.pos.x >> p.pos.y >> p.pos.z >> p.speed.x >> p.speed.y >> p.speed.z;
-		_initialParticles.push_back(p);
+		particles.push_back(p);
 	}
 
 	std::cout << "Done." << std::endl;
 
-	computeHalfVelocity();
+	setInitialState(particles, filename);
 	reset();
 }
 
@@ -54,8 +75,8 @@ void GravitySimulation::loadDataset(const std::string& filename)
 //and a speed of (0,0,0)
 void GravitySimulation::generateRandomUniform(unsigned int nbParticles, float mass, float width, float height, float depth)
 {
-	_initialParticles.clear();
-	_initialParticles.reserve(nbParticles);
+	ParticleState particles;
+	particles.reserve(nbParticles);
 
 	Particle p;
 	for (unsigned int i = 0; i < nbParticles; ++i) {
@@ -64,56 +85,277 @@ void GravitySimulation::generateRandomUniform(unsigned int nbParticles, float ma
 		p.pos.x = rand() / static_cast<float>(RAND_MAX) * width - (width * 0.5f);
 		p.pos.y = rand() / static_cast<float>(RAND_MAX) * height - (height * 0.5f);
 		p.pos.z = rand() / static_cast<float>(RAND_MAX) * depth - (depth * 0.5f);
-		_initialParticles.push_back(p);
+		particles.push_back(p);
 	}
 
-	computeHalfVelocity();
+	setInitialState(particles, "");
 	reset();
 }
 
 void GravitySimulation::reset()
 {
+	_readback.finish(); //A pending switch to the CPU happens before the reset
 	_paused = true;
 	_initialTick = true;
+	_tickCount = 0;
 
 	if (_onGPU) {
-		std::vector<float> pos;
-		std::vector<float> speed;
-
-		Particle p;
-		for (unsigned int i = 0; i < _initialParticles.size(); ++i) {
-			p = _initialParticles[i];
-
-			pos.push_back(p.pos.x);
-			pos.push_back(p.pos.y);
-			pos.push_back(p.pos.z);
-			pos.push_back(p.mass); //Mass is packed with the position since it seems we can't have vec3 in our SSBOs anyway
-
-			speed.push_back(p.speed.x);
-			speed.push_back(p.speed.y);
-			speed.push_back(p.speed.z);
-			speed.push_back(0.0f); //Padding
-		}
-
-		_positionBuffer.setData(pos);
-		_speedBuffer.setData(speed);
+		resetGPUState();
 	}
 	else {
-		_CPUParticles = _initialParticles;
+		_CPUParticles = getInitialCPUParticles();
+	}
+}
+
+void GravitySimulation::resetGPUState()
+{
+	if (!hasSynchronizedSpeeds()) {
+		updateHalfStepSpeeds();
 	}
+
+	//Copies on the GPU. The Hermite integrator keeps the speeds synchronized with the positions.
+	const GPUBuffer<float>& speeds = hasSynchronizedSpeeds() ? _initialSpeedBuffer : _halfStepSpeedBuffer;
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	_positionBuffer.copyFrom(_initialPositionBuffer);
+	_speedBuffer.copyFrom(speeds);
+	_nextPositionBuffer.copyFrom(_initialPositionBuffer);
+	_nextSpeedBuffer.copyFrom(speeds);
+
+	std::vector<unsigned int> ids(_particleCount);
+	std::iota(ids.begin(), ids.end(), 0);
+	resizeGPUState(ids);
 }
 
 void GravitySimulation::tick()
 {
-	if (_paused) return;
+	_readback.poll();
+	if (_paused || _leavingGPU) return;
 
 	if (_onGPU) {
-		_computePrograms[_currentComputeProgramIndex].bind();
-		glDispatchCompute(_initialParticles.size() / (1 << _currentComputeProgramIndex), 1, 1);
+		const Composition* composition = getComposition(_CPUEngine.getIntegrator());
+		bool adaptive = isAdaptiveOnGPU();
+		bool hermite = !adaptive && _CPUEngine.getIntegrator() == CPU_INTEGRATOR_HERMITE;
+		if (adaptive) {
+			adaptiveTickGPU();
+		}
+		else if (hermite) {
+			hermiteTickGPU();
+		}
+		else if (composition) {
+			compositionTickGPU(*composition);
+		}
+		else if (_GPUSolver == GPU_BARNES_HUT) {
+			treeTickGPU();
+		}
+		else {
+			unsigned int index = computeProgramIndex();
+			_computePrograms[index].bind();
+			glDispatchCompute(groupCount(index), 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			swapStateBuffers();
+		}
+
+		//The stored accelerations only stay valid while the integrator that computed them keeps ticking
+		_GPUHermiteReady = _GPUHermiteReady && hermite;
+		_GPUForcesReady = _GPUForcesReady && adaptive;
+
+		if (_reorderInterval > 0 && ++_GPUTicksSinceReorder >= _reorderInterval) {
+			reorderGPU();
+		}
 	}
 	else {
 		integrateCPU();
 	}
+
+	++_tickCount;
+	if (_energyInterval > 0 && _tickCount % _energyInterval == 0) {
+		printEnergy();
+	}
+	if (_snapshotInterval > 0 && _tickCount % _snapshotInterval == 0) {
+		saveSnapshot("snapshot_" + std::to_string(_tickCount) + ".dat");
+	}
+}
+
+//The base programs read the state from the buffers bound to 0 and 1 and write the next one to 15 and 16, so no work group
+//sees positions of another tick. Once the dispatch is done the next state becomes the completed one.
+void GravitySimulation::swapStateBuffers()
+{
+	std::swap(_positionBuffer, _nextPositionBuffer);
+	std::swap(_speedBuffer, _nextSpeedBuffer);
+
+	_positionBuffer.bindBase(0);
+	_speedBuffer.bindBase(1);
+	_nextPositionBuffer.bindBase(15);
+	_nextSpeedBuffer.bindBase(16);
+}
+
+//One Hermite step: predict every particle, then evaluate and correct once all the predictions are written
+void GravitySimulation::hermiteTickGPU()
+{
+	unsigned int index = computeProgramIndex();
+	ShaderProg& program = _hermitePrograms[index];
+	unsigned int groups = groupCount(index);
+
+	if (!_GPUHermiteReady) {
+		_hermiteStage = 1; //Copy
+		program.bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		_hermiteStage = 3; //Evaluate
+		program.bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		_GPUHermiteReady = true;
+	}
+
+	_hermiteStage = 0; //Predict
+	program.bind();
+	glDispatchCompute(groups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	_hermiteStage = 2; //Evaluate and correct
+	program.bind();
+	glDispatchCompute(groups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+//Drifts and kicks of a composition integrator, each dispatch waiting for the previous one
+void GravitySimulation::compositionTickGPU(const Composition& composition)
+{
+	unsigned int index = computeProgramIndex();
+	unsigned int groups = groupCount(index);
+
+	for (unsigned int s = 0; s <= composition.stages; ++s) {
+		_stageCoefficient = static_cast<float>(composition.drift[s]);
+		_driftPrograms[index].bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		if (s == composition.stages) break;
+
+		_stageCoefficient = static_cast<float>(composition.kick[s]);
+		if (_GPUSolver == GPU_BARNES_HUT) {
+			_GPUTree.computeAccelerations(_particleCount, _stageCoefficient);
+			continue;
+		}
+		_kickPrograms[index].bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+}
+
+//Leapfrog step of the base shader with the accelerations of the GPU tree: drift every particle, then build the tree over the
+//new positions and kick with the walk
+void GravitySimulation::treeTickGPU()
+{
+	_stageCoefficient = 1.0f;
+	unsigned int index = computeProgramIndex();
+	_driftPrograms[index].bind();
+	glDispatchCompute(groupCount(index), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	_GPUTree.computeAccelerations(_particleCount, 1.0f);
+}
+
+//Adaptive leapfrog step, iterated like the CPU: tau at the current positions extrapolated with the previous step gives the first
+//trial, then the state is restored from copies on the GPU and the step retaken with (tau(start) + tau(end)) / 2 until dt settles.
+//Every trial costs an evaluation and the readback of tau.
+void GravitySimulation::adaptiveTickGPU()
+{
+	unsigned int index = computeProgramIndex();
+	ShaderProg& program = _adaptivePrograms[index];
+	unsigned int groups = groupCount(index);
+
+	if (!_GPUForcesReady) {
+		_adaptiveStage = 2; //Evaluate
+		clearCriterion();
+		program.bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		_GPUCriterion = readCriterion();
+		_GPUTimeStepController.reset();
+		_GPUForcesReady = true;
+	}
+
+	bool iterate = _GPUTimeStepController.getIterations() > 1;
+	if (iterate) {
+		_savedPositionBuffer.copyFrom(_positionBuffer);
+		_savedSpeedBuffer.copyFrom(_speedBuffer);
+		_savedAccelerationBuffer.copyFrom(_accelerationBuffer);
+	}
+
+	double start = _GPUCriterion;
+	double dt = _GPUTimeStepController.guess(start, _dt);
+	for (unsigned int iteration = 0;; ++iteration) {
+		_GPUTimeStep = static_cast<float>(dt);
+
+		_adaptiveStage = 0; //Half-kick and drift
+		program.bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		_adaptiveStage = 1; //Evaluate and half-kick
+		clearCriterion();
+		program.bind();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		_GPUCriterion = readCriterion();
+		double symmetric = _GPUTimeStepController.symmetric(start, _GPUCriterion, _dt);
+		if (_GPUTimeStepController.converged(dt, symmetric, iteration)) break;
+
+		_positionBuffer.copyFrom(_savedPositionBuffer);
+		_speedBuffer.copyFrom(_savedSpeedBuffer);
+		_accelerationBuffer.copyFrom(_savedAccelerationBuffer);
+		dt = symmetric;
+	}
+
+	_GPUTimeStepController.accept(start, dt);
+}
+
+//Raises the minimum of the adaptive programs to the largest float on the GPU, before an evaluation lowers it
+void GravitySimulation::clearCriterion()
+{
+	const GLuint largest = 0x7f7fffff;
+	_criterionBuffer.bind();
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &largest);
+}
+
+//Reads the minimum written by the last evaluation of the adaptive programs, through the mapping with a single fence
+double GravitySimulation::readCriterion()
+{
+	std::vector<unsigned int> value;
+	_criterionBuffer.getData(value);
+
+	float minimum;
+	memcpy(&minimum, &value[0], sizeof(float));
+	return _GPUTimeStepController.criterion(minimum);
+}
+
+bool GravitySimulation::isAdaptiveOnGPU() const
+{
+	unsigned int integrator = _CPUEngine.getIntegrator();
+	return _CPUEngine.isAdaptiveTimeStep() && (integrator == CPU_INTEGRATOR_LEAPFROG || integrator == CPU_INTEGRATOR_BLOCK_LEAPFROG);
+}
+
+bool GravitySimulation::hasSynchronizedSpeeds() const
+{
+	unsigned int integrator = _CPUEngine.getIntegrator();
+	if (_CPUEngine.isAdaptiveTimeStep()) {
+		return _onGPU || integrator != CPU_INTEGRATOR_BLOCK_LEAPFROG;
+	}
+	return integrator == CPU_INTEGRATOR_HERMITE || getComposition(integrator) != nullptr;
+}
+
+double GravitySimulation::getTimeStep() const
+{
+	if (_onGPU) {
+		return isAdaptiveOnGPU() ? _GPUTimeStepController.getTimeStep() : _dt;
+	}
+	return _CPUEngine.getTimeStep();
 }
 
 void GravitySimulation::render()
@@ -126,7 +368,7 @@ void GravitySimulation::render()
 		glEnableVertexAttribArray(0);
 		_vao.bind();
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-		glDrawArraysInstanced(GL_POINTS, 0, 1, _initialParticles.size());
+		glDrawArraysInstanced(GL_POINTS, 0, 1, _particleCount);
 		glDisableVertexAttribArray(0);
 	}
 	else { //Very bad way of rendering 
@@ -134,7 +376,7 @@ void GravitySimulation::render()
 
 		for (unsigned int i = 0; i < _CPUParticles.size(); ++i) {
 			glBegin(GL_POINTS);
-				glVertex3f(_CPUParticles[i].pos.x, _CPUParticles[i].pos.y, _CPUParticles[i].pos.z);
+				glVertex3f(_CPUParticles.x[i], _CPUParticles.y[i], _CPUParticles.z[i]);
 			glEnd();
 		}
 	}
@@ -151,111 +393,291 @@ void GravitySimulation::playPause()
 	_paused = !_paused;
 }
 
-glm::vec3 GravitySimulation::computeAccelCPU(const Particle& p) const
+//Leapfrog integration (global or block time steps) with euler method used for the first velocity half-step, or Hermite integration.
+void GravitySimulation::integrateCPU()
 {
-	glm::vec3 a(0.0, 0.0, 0.0);
-	for (unsigned int i = 0; i < _CPUParticles.size(); ++i) {
-		glm::vec3 r = _CPUParticles[i].pos - p.pos;
-		float distSqr = r.x * r.x + r.y * r.y + r.z * r.z + _eps2;
-		float distSixth = distSqr * distSqr * distSqr;
-		float invDistCube = 1.0f / sqrtf(distSixth);
-		a += (_CPUParticles[i].mass * invDistCube) * r * _G;
-	}
-	return a;
+	_CPUEngine.step(_CPUParticles, _dt, _G, _eps2, _initialTick);
+	_initialTick = false;
 }
 
-//Leapfrog integration with euler method used for the first velocity half-step.
-void GravitySimulation::integrateCPU()
+//Leaving the GPU only completes once its state is read back, the GPU pausing and the frames going on meanwhile
+void GravitySimulation::setOnGPU(bool onGPU)
 {
-	glm::vec3 a; //Acceleration
+	if (onGPU == isOnGPU()) return;
 
-	if (_initialTick) {
-		_initialTick = false;
+	if (onGPU && _leavingGPU) { //Still on the GPU, the pending switch is dropped
+		_leavingGPU = false;
+		++_switchGeneration;
+		return;
+	}
 
-		for (unsigned int i = 0; i < _CPUParticles.size(); ++i) {
-			a = computeAccelCPU(_CPUParticles[i]);
-			_CPUParticles[i].speed += 0.5f * _dt * a;
+	if (onGPU) {
+		_onGPU = true;
+		if (_initialTick && !hasSynchronizedSpeeds()) {
+			resetGPUState(); //The CPU has not taken its half-step yet, the GPU leapfrogs start from the half-stepped speeds
 		}
+		else {
+			uploadParticles(_CPUParticles);
+		}
+		return;
 	}
 
-	for (unsigned int i = 0; i < _CPUParticles.size(); ++i) {
-		_CPUParticles[i].pos += _dt * _CPUParticles[i].speed;
-		a = computeAccelCPU(_CPUParticles[i]);
-		_CPUParticles[i].speed += _dt * a;
+	//The GPU speeds already follow the convention of its integrator, the half-step of the leapfrogs included
+	_leavingGPU = true;
+	unsigned int generation = ++_switchGeneration;
+	bool synchronized = hasSynchronizedSpeeds();
+	requestParticles([this, generation, synchronized](ParticleArrays& particles) {
+		if (!_leavingGPU || generation != _switchGeneration) return; //Dropped or superseded by a later switch
+
+		_CPUParticles = particles;
+		_CPUEngine.invalidateState();
+		_CPUEngine.setSynchronizedVelocities(synchronized);
+		_initialTick = false;
+		_onGPU = false;
+		_leavingGPU = false;
+	});
+}
+
+//Switching between the leapfrog and an integrator with synchronized speeds on the GPU restarts the simulation
+void GravitySimulation::setIntegrator(unsigned int integrator)
+{
+	bool wasSynchronized = hasSynchronizedSpeeds();
+	_CPUEngine.setIntegrator(integrator);
+
+	if (_onGPU && hasSynchronizedSpeeds() != wasSynchronized) {
+		reset();
 	}
 }
 
-void GravitySimulation::setOnGPU(bool onGPU)
+void GravitySimulation::setAdaptiveTimeStep(float eta)
 {
-	if (onGPU == _onGPU) return;
+	bool wasSynchronized = hasSynchronizedSpeeds();
 
-	_onGPU = onGPU;
+	_CPUEngine.setAdaptiveTimeStep(eta > 0.0f);
+	if (eta > 0.0f) {
+		_CPUEngine.getTimeStepController().setAccuracy(eta);
+		_GPUTimeStepController.setAccuracy(eta);
+	}
 
-	if (onGPU) {
-		std::vector<float> pos;
-		std::vector<float> speed;
+	if (_onGPU && hasSynchronizedSpeeds() != wasSynchronized) {
+		reset();
+	}
+}
 
-		Particle p;
-		for (unsigned int i = 0; i < _CPUParticles.size(); ++i) {
-			p = _CPUParticles[i];
+//Sends particles to the GPU position and speed buffers, packed in the reused transfer state
+void GravitySimulation::uploadParticles(const ParticleArrays& particles)
+{
+	_transferState.assign(particles);
+	uploadState(_transferState.positions, _transferState.speeds, _transferState.id);
+}
 
-			pos.push_back(p.pos.x);
-			pos.push_back(p.pos.y);
-			pos.push_back(p.pos.z);
-			pos.push_back(p.mass); //Mass is packed with the position since it seems we can't have vec3 in our SSBOs anyway
+//Both arrays being laid out like the buffers, the upload is a plain copy
+void GravitySimulation::uploadState(const std::vector<float>& positions, const std::vector<float>& speeds, const std::vector<unsigned int>& ids)
+{
+	_positionBuffer.setData(positions);
+	_speedBuffer.setData(speeds);
+	_nextPositionBuffer.setData(positions);
+	_nextSpeedBuffer.setData(speeds);
+	resizeGPUState(ids);
+}
 
-			speed.push_back(p.speed.x);
-			speed.push_back(p.speed.y);
-			speed.push_back(p.speed.z);
-			speed.push_back(0.0f); //Padding
+//Sizes the buffers of the integrators for the particles of the state buffers, whose original indices are ids
+void GravitySimulation::resizeGPUState(const std::vector<unsigned int>& ids)
+{
+	std::vector<float> idBits(ids.size());
+	if (!ids.empty()) {
+		memcpy(idBits.data(), ids.data(), sizeof(unsigned int) * ids.size());
+	}
+	_idBuffer.setData(idBits);
+	_nextIdBuffer.resize(ids.size(), false);
+
+	//Storage of the Hermite integrator, its acceleration and jerk get recomputed on the next tick so it needs no upload
+	_accelerationBuffer.resize(ids.size() * 4, false);
+	_jerkBuffer.resize(ids.size() * 4, false);
+	_predictedPositionBuffer.resize(ids.size() * 4, false);
+	_predictedSpeedBuffer.resize(ids.size() * 4, false);
+	_GPUHermiteReady = false;
+	_GPUForcesReady = false;
+
+	std::vector<unsigned int> criterion(1, 0x7f7fffff);
+	_criterionBuffer.setData(criterion);
+	_GPUTicksSinceReorder = 0;
+}
+
+//Copies the state of the GPU simulation into particles
+void GravitySimulation::downloadParticles(ParticleArrays& particles)
+{
+	_positionBuffer.getData(_transferState.positions);
+	_speedBuffer.getData(_transferState.speeds);
+	std::vector<float> idBits;
+	_idBuffer.getData(idBits);
+	_transferState.id.resize(idBits.size());
+	if (!idBits.empty()) {
+		memcpy(_transferState.id.data(), idBits.data(), sizeof(unsigned int) * idBits.size());
+	}
+
+	particles.assign(_transferState);
+}
+
+//Same as downloadParticles without stalling, callback getting the particles of the current state a few frames later
+void GravitySimulation::requestParticles(const std::function<void(ParticleArrays&)>& callback)
+{
+	//The ids are read with the state, the buffers being reordered on the GPU
+	std::vector<const GPUBuffer<float>*> buffers{ &_positionBuffer, &_speedBuffer, &_idBuffer };
+
+	_readback.request(buffers, [callback](std::vector<std::vector<float>>& data) {
+		ParticleState state;
+		state.positions.swap(data[0]);
+		state.speeds.swap(data[1]);
+		state.id.resize(data[2].size());
+		if (!data[2].empty()) {
+			memcpy(state.id.data(), data[2].data(), sizeof(unsigned int) * data[2].size());
 		}
 
-		_positionBuffer.setData(pos);
-		_speedBuffer.setData(speed);
+		ParticleArrays particles;
+		particles.assign(state);
+		callback(particles);
+	});
+}
+
+//Sorts the GPU buffers along the Morton curve without leaving the GPU: the tree sorts the particles along their keys, then the
+//state, the accelerations and jerks of the integrators and the ids are gathered in that order. The stored accelerations and
+//the minimum of the adaptive step do not depend on the order, so the integrators keep going without any new evaluation.
+void GravitySimulation::reorderGPU()
+{
+	_GPUTicksSinceReorder = 0;
+	if (_particleCount == 0) return;
+
+	_GPUTree.sortParticles(_particleCount);
+
+	_reorderProgram.bind();
+	glDispatchCompute((_particleCount + REORDER_GROUP_SIZE - 1) / REORDER_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	swapStateBuffers();
+	std::swap(_accelerationBuffer, _predictedPositionBuffer);
+	std::swap(_jerkBuffer, _predictedSpeedBuffer);
+	std::swap(_idBuffer, _nextIdBuffer);
+
+	_accelerationBuffer.bindBase(2);
+	_jerkBuffer.bindBase(3);
+	_predictedPositionBuffer.bindBase(4);
+	_predictedSpeedBuffer.bindBase(5);
+	_idBuffer.bindBase(18);
+	_nextIdBuffer.bindBase(19);
+}
+
+void GravitySimulation::setReorderInterval(unsigned int ticks)
+{
+	_reorderInterval = ticks;
+	_CPUEngine.setReorderInterval(ticks);
+}
+
+//Writes the current state in the dataset format (mass, position, speed), particles being listed in their original order
+void GravitySimulation::saveSnapshot(const std::string& filename)
+{
+	if (_onGPU) {
+		requestParticles([this, filename](ParticleArrays& particles) { writeSnapshot(filename, particles); });
 	}
 	else {
-		std::vector<float> pos;
-		std::vector<float> speed;
+		writeSnapshot(filename, _CPUParticles);
+	}
+}
 
-		_positionBuffer.getData(pos);
-		_speedBuffer.getData(speed);
+void GravitySimulation::writeSnapshot(const std::string& filename, const ParticleArrays& particles) const
+{
+	std::ofstream file(filename);
+	if (!file) {
+		std::cout << "Cannot open snapshot file " << filename << "." << std::endl;
+		return;
+	}
 
-		_CPUParticles.clear();
-		Particle p;
-		for (unsigned int i = 0; i < pos.size() / 4; ++i) {
-			p.pos.x = pos[i * 4 + 0];
-			p.pos.y = pos[i * 4 + 1];
-			p.pos.z = pos[i * 4 + 2];
+	std::vector<unsigned int> slot(particles.size());
+	for (unsigned int i = 0; i < particles.size(); ++i) {
+		slot[particles.id[i]] = i;
+	}
 
-			p.mass = pos[i * 4 + 3];
+	for (unsigned int k = 0; k < particles.size(); ++k) {
+		Particle p = particles.get(slot[k]);
+		file << p.mass << " " << p.pos.x << " " << p.pos.y << " " << p.pos.z << " " << p.speed.x << " " << p.speed.y << " " << p.speed.z << "\n";
+	}
 
-			p.speed.x = speed[i * 4 + 0];
-			p.speed.y = speed[i * 4 + 1];
-			p.speed.z = speed[i * 4 + 2];
+	std::cout << "Snapshot saved to " << filename << "." << std::endl;
+}
 
-			_CPUParticles.push_back(p);
+//Prints the kinetic, potential and total energy of the current state.
+//With leapfrog integration the velocities are half a step ahead of the positions so the total is only approximate.
+void GravitySimulation::printEnergy()
+{
+	if (_onGPU) {
+		unsigned int tick = _tickCount;
+		requestParticles([this, tick](ParticleArrays& particles) { writeEnergy(particles, tick); });
+	}
+	else {
+		writeEnergy(_CPUParticles, _tickCount);
+	}
+}
+
+void GravitySimulation::writeEnergy(const ParticleArrays& particles, unsigned int tick)
+{
+	double kinetic, potential;
+	_CPUEngine.computeEnergy(particles, _G, _eps2, kinetic, potential);
+
+	std::cout << "Tick " << tick << "   Kinetic energy : " << kinetic << "   Potential energy : " << potential << "   Total : " << (kinetic + potential) << std::endl;
+}
+
+//Total energy of the current state. The leapfrog speeds being half a step ahead of the positions, they are brought back first.
+double GravitySimulation::currentEnergy()
+{
+	ParticleArrays particles;
+	if (_onGPU) {
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		downloadParticles(particles);
+	}
+	else {
+		particles = _CPUParticles;
+	}
+
+	//On the CPU the half-step is only taken by the first tick
+	if (!hasSynchronizedSpeeds() && (_onGPU || !_initialTick)) {
+		_CPUEngine.computeAccelerations(particles, _G, _eps2);
+		for (unsigned int i = 0; i < particles.size(); ++i) {
+			particles.vx[i] -= 0.5f * _dt * particles.ax[i];
+			particles.vy[i] -= 0.5f * _dt * particles.ay[i];
+			particles.vz[i] -= 0.5f * _dt * particles.az[i];
 		}
 	}
+
+	double kinetic, potential;
+	_CPUEngine.computeEnergy(particles, _G, _eps2, kinetic, potential);
+	return kinetic + potential;
 }
 
 //Performs a benchmark with various parameters
 //Outputs CPU fps results into file benchmark_cpu.cvs
 //Outputs GPU fps results into file benchmark_gpu_gpu.cvs
+//Outputs the cost of every integrator at a fixed energy error into file benchmark_integrators.csv
 void GravitySimulation::benchmark()
 {
 	float lastDt = _dt;
 	float lastG = _G;
 	float lastEps2 = _eps2;
-	auto lastParticles = _initialParticles;
+	ParticleState lastParticles; //The benchmarks replace the initial state, kept on the host meanwhile
+	std::string lastCacheName = _cacheName;
+	downloadInitialState(lastParticles);
 	bool wasOnGpu = _onGPU;
 	unsigned int lastCurrentComputeProgramIndex = _currentComputeProgramIndex;
 	unsigned int lastOptiLevel = _opLevel;
+	unsigned int lastIntegrator = _CPUEngine.getIntegrator();
+	float lastAdaptiveEta = _CPUEngine.isAdaptiveTimeStep() ? _CPUEngine.getTimeStepController().getAccuracy() : 0.0f;
 
 	std::cout << "\n\n########## Benchmark ##########\nWarning: La fenetre va geler pendant les tests.\n\n";
 
 	unsigned long testLength = 5000; //In milliseconds
 
-	_opLevel = 1;
+	setOptimizationLevel(1);
+	setIntegrator(CPU_INTEGRATOR_LEAPFROG);
+	setAdaptiveTimeStep(0.0f);
 
 	//CPU tests
 	std::cout << "CPU TESTS" << std::endl;
@@ -263,19 +685,67 @@ void GravitySimulation::benchmark()
 	setG(1.0f);
 	setEps2(10.0f);
 	setOnGPU(false);
-	std::vector<unsigned int> nbParticles{ 128, 256, 512, 1024, 2048, 4096, 8192 };
+	std::vector<unsigned int> nbParticles{ 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768 };
 	std::ofstream cpuFpsFile("benchmark_cpu.csv");
-	cpuFpsFile << "nbParticles" << "," << "fps" << std::endl;
+	cpuFpsFile << "nbParticles" << "," << "naive" << "," << "tiled" << "," << "tiled + unrolled" << std::endl;
 	for (unsigned int i = 0; i < nbParticles.size(); ++i) {
-		std::cout << "Test " << (i+1) << " sur " << nbParticles.size() << "..." << std::endl;
+		generateRandomUniform(nbParticles[i], 10.0f, 2.0f, 2.0f, 2.0f);
+		cpuFpsFile << nbParticles[i];
+		for (unsigned int level = 0; level < 3; ++level) {
+			std::cout << "Test " << (i * 3 + level + 1) << " sur " << (nbParticles.size() * 3) << "..." << std::endl;
+
+			setOptimizationLevel(level);
+			reset();
+			_paused = false;
 
+			double fps = runFor(testLength);
+
+			cpuFpsFile << "," << fps;
+		}
+		cpuFpsFile << std::endl;
+	}
+
+	setOptimizationLevel(1);
+
+	//CPU precision tests, direct sum
+	std::cout << "CPU PRECISION TESTS" << std::endl;
+	unsigned int lastPrecision = _CPUEngine.getPrecision();
+	unsigned int lastSolver = _CPUEngine.getSolver();
+	setCPUSolver(CPU_DIRECT_SUM);
+	nbParticles = std::vector<unsigned int>{ 1024, 4096, 16384 };
+	std::ofstream precisionFile("benchmark_cpu_precision.csv");
+	precisionFile << "nbParticles" << "," << "float" << "," << "double" << "," << "mixed" << std::endl;
+	for (unsigned int i = 0; i < nbParticles.size(); ++i) {
 		generateRandomUniform(nbParticles[i], 10.0f, 2.0f, 2.0f, 2.0f);
-		_paused = false;
+		precisionFile << nbParticles[i];
+		for (unsigned int precision = 0; precision < CPU_PRECISION_COUNT; ++precision) {
+			std::cout << "Test " << (i * CPU_PRECISION_COUNT + precision + 1) << " sur " << (nbParticles.size() * CPU_PRECISION_COUNT) << "..." << std::endl;
+
+			setCPUPrecision(precision);
+			reset();
+			_paused = false;
 
-		double fps = runFor(testLength);
+			double fps = runFor(testLength);
 
-		cpuFpsFile << nbParticles[i] << "," << fps << std::endl;
+			precisionFile << "," << fps;
+		}
+		precisionFile << std::endl;
 	}
+	setCPUPrecision(lastPrecision);
+
+	//Integrator tests, on a cold collapse with a total mass of 1
+	std::cout << "INTEGRATOR TESTS" << std::endl;
+	setG(1.0f);
+	setEps2(0.01f);
+	generateRandomUniform(1024, 1.0f / 1024, 2.0f, 2.0f, 2.0f);
+	std::ofstream integratorFile("benchmark_integrators.csv");
+	integratorFile << "device" << "," << "integrator" << "," << "dt" << "," << "energyError" << "," << "secondsPerTimeUnit" << std::endl;
+	benchmarkIntegrators(integratorFile, "CPU");
+	setOnGPU(true);
+	benchmarkIntegrators(integratorFile, "GPU");
+	setOnGPU(false);
+	setIntegrator(CPU_INTEGRATOR_LEAPFROG);
+	setCPUSolver(lastSolver);
 
 	//GPU tests
 	std::cout << "GPU TESTS" << std::endl;
@@ -312,11 +782,62 @@ void GravitySimulation::benchmark()
 	_eps2 = lastEps2;
 	setOnGPU(wasOnGpu);
 	_currentComputeProgramIndex = lastCurrentComputeProgramIndex;
-	_opLevel = lastOptiLevel;
-	_initialParticles = lastParticles;
+	setOptimizationLevel(lastOptiLevel);
+	setIntegrator(lastIntegrator);
+	setAdaptiveTimeStep(lastAdaptiveEta);
+	setInitialState(lastParticles, lastCacheName);
 	reset();
 }
 
+//For each integrator, halves dt until the relative energy error after a fixed simulated time fits the budget,
+//then writes the wall time per unit of simulated time of that run. Runs on the current device with the current particles.
+void GravitySimulation::benchmarkIntegrators(std::ostream& file, const std::string& device)
+{
+	const double budget = 1e-5; //Relative energy error
+	const float duration = 1.0f; //Simulated time of every run, before the core bounce of the collapse
+	const unsigned long maxTime = 120000; //In milliseconds, for the whole search of an integrator
+
+	std::vector<unsigned int> integrators{ CPU_INTEGRATOR_LEAPFROG, CPU_INTEGRATOR_HERMITE, CPU_INTEGRATOR_FOREST_RUTH, CPU_INTEGRATOR_YOSHIDA6, CPU_INTEGRATOR_PEFRL };
+	std::vector<std::string> names{ "leapfrog", "hermite", "forest-ruth", "yoshida6", "pefrl" };
+
+	for (unsigned int k = 0; k < integrators.size(); ++k) {
+		std::cout << device << " " << names[k] << "..." << std::endl;
+		setIntegrator(integrators[k]);
+
+		bool found = false;
+		unsigned long totalTime = 0;
+		for (float dt = 0.1f; dt > 1e-5f && !found; dt *= 0.5f) {
+			setDt(dt);
+			reset();
+			double initialEnergy = currentEnergy();
+
+			unsigned int steps = static_cast<unsigned int>(std::ceil(duration / dt));
+			_paused = false;
+			Timer timer;
+			timer.start();
+			for (unsigned int s = 0; s < steps; ++s) {
+				tick();
+			}
+			glFinish();
+			unsigned long time = timer.elapsed();
+			totalTime += time;
+
+			double error = std::abs((currentEnergy() - initialEnergy) / initialEnergy);
+			if (error <= budget) {
+				file << device << "," << names[k] << "," << dt << "," << error << "," << (time / 1000.0) / (steps * dt) << std::endl;
+				found = true;
+			}
+			else if (totalTime + 2 * time > maxTime) { //The next run, twice as many steps, would exceed the budget
+				break;
+			}
+		}
+
+		if (!found) {
+			file << device << "," << names[k] << ",,," << std::endl;
+		}
+	}
+}
+
 //Generates n shader source code with local work size from 1 to 2^(n-1)
 void GravitySimulation::generateShaderSources(const std::string& baseFilename, unsigned int n, std::vector<std::string>& shaderSources) const
 {
@@ -378,7 +899,9 @@ void GravitySimulation::generateShaderSources(const std::string& baseFilename, u
 						line = content;
 						std::ostringstream oss;
 						oss << j;
-						line.replace(pos, 4, oss.str());
+						for (size_t id = pos; id != std::string::npos; id = line.find("#ID#", id)) { //Every occurrence
+							line.replace(id, 4, oss.str());
+						}
 
 						shaderSources[i] += line + '\n';
 					}
@@ -411,61 +934,193 @@ void GravitySimulation::generatePrograms(const std::vector<std::string>& shaderS
 	_GPURenderProgram.finalize();
 	_GPURenderProgram.registerUniform("opacity", &_opacity);
 
-	_halfVelocityProgram.loadShader(GL_COMPUTE_SHADER, "shaders/half_step.cs");
-	_halfVelocityProgram.finalize();
-	_halfVelocityProgram.registerUniform("G", &_G);
-	_halfVelocityProgram.registerUniform("dt", &_dt);
-	_halfVelocityProgram.registerUniform("EPS2", &_eps2);
-
 	_computePrograms.resize(shaderSources.size());
 	for (unsigned int i = 0; i < shaderSources.size(); ++i) {
 		_computePrograms[i].loadShaderFromStr(GL_COMPUTE_SHADER, shaderSources[i]);
-		_computePrograms[i].finalize();
+		_computePrograms[i].finalize(true);
 
 		_computePrograms[i].registerUniform("G", &_G);
 		_computePrograms[i].registerUniform("dt", &_dt);
 		_computePrograms[i].registerUniform("EPS2", &_eps2);
 		_computePrograms[i].registerUniform("optimization", &_opLevel);
  	}
+
+	generateComputePrograms("shaders/hermite.cs", _hermitePrograms);
+	for (unsigned int i = 0; i < _hermitePrograms.size(); ++i) {
+		_hermitePrograms[i].registerUniform("stage", &_hermiteStage);
+	}
+
+	generateComputePrograms("shaders/kick.cs", _kickPrograms);
+	generateComputePrograms("shaders/drift.cs", _driftPrograms);
+	for (unsigned int i = 0; i < _kickPrograms.size(); ++i) {
+		_kickPrograms[i].registerUniform("coefficient", &_stageCoefficient);
+		_kickPrograms[i].registerUniform("stage", &_kickStage);
+	}
+	for (unsigned int i = 0; i < _driftPrograms.size(); ++i) {
+		_driftPrograms[i].registerUniform("coefficient", &_stageCoefficient);
+	}
+
+	generateComputePrograms("shaders/adaptive.cs", _adaptivePrograms);
+	for (unsigned int i = 0; i < _adaptivePrograms.size(); ++i) {
+		_adaptivePrograms[i].registerUniform("timeStep", &_GPUTimeStep);
+		_adaptivePrograms[i].registerUniform("stage", &_adaptiveStage);
+	}
+
+	_GPUTree.loadPrograms(&_G, &_dt, &_eps2);
+
+	_reorderProgram.loadShader(GL_COMPUTE_SHADER, "shaders/reorder.cs");
+	_reorderProgram.finalize();
 }
 
-void GravitySimulation::computeHalfVelocity()
+//Builds one program per work group size from a base shader, with the uniforms shared by every simulation shader. The programs
+//are lazy, the unrolled variants of the large work groups being long to compile.
+void GravitySimulation::generateComputePrograms(const std::string& baseFilename, std::vector<ShaderProg>& programs)
 {
-	//Load initial data into GPU
-	std::vector<float> pos;
-	std::vector<float> speed;
+	std::vector<std::string> sources;
+	generateShaderSources(baseFilename, _computePrograms.size(), sources);
 
-	Particle p;
-	for (unsigned int i = 0; i < _initialParticles.size(); ++i) {
-		p = _initialParticles[i];
+	programs.resize(sources.size());
+	for (unsigned int i = 0; i < sources.size(); ++i) {
+		programs[i].loadShaderFromStr(GL_COMPUTE_SHADER, sources[i]);
+		programs[i].finalize(true);
+
+		programs[i].registerUniform("G", &_G);
+		programs[i].registerUniform("dt", &_dt);
+		programs[i].registerUniform("EPS2", &_eps2);
+		programs[i].registerUniform("optimization", &_opLevel);
+	}
+}
 
-		pos.push_back(p.pos.x);
-		pos.push_back(p.pos.y);
-		pos.push_back(p.pos.z);
-		pos.push_back(p.mass); //Mass is packed with the position since it seems we can't have vec3 in our SSBOs anyway
+//The selected work group size, raised while the particles need more work groups than a dispatch allows
+unsigned int GravitySimulation::computeProgramIndex() const
+{
+	unsigned int index = _currentComputeProgramIndex;
+	while (index + 1 < _computePrograms.size() && groupCount(index) > static_cast<unsigned int>(_maxGroupCount)) {
+		++index;
+	}
+	return index;
+}
+
+//The last work group is only partly filled when the count is not a multiple of the work group size
+unsigned int GravitySimulation::groupCount(unsigned int programIndex) const
+{
+	unsigned int groupSize = 1 << programIndex;
+	return (_particleCount + groupSize - 1) / groupSize;
+}
+
+//The host keeps no copy of the initial conditions: the GPU holds them, and the CPU engine reads them back when it needs them.
+//The initial accelerations of the particles of a dataset file are cached on disk, next to the file.
+void GravitySimulation::setInitialState(const ParticleState& state, const std::string& cacheName)
+{
+	_particleCount = state.size();
+	_initialPositionBuffer.setData(state.positions);
+	_initialSpeedBuffer.setData(state.speeds);
+	_initialCPUParticles.clear();
+
+	_cacheName = cacheName;
+	_initialHash = hashBytes(state.positions.data(), sizeof(float) * state.positions.size());
+	_initialAccelerationsReady = false;
+	_halfStepReady = false;
+}
 
-		speed.push_back(p.speed.x);
-		speed.push_back(p.speed.y);
-		speed.push_back(p.speed.z);
-		speed.push_back(0.0f); //Padding
+void GravitySimulation::downloadInitialState(ParticleState& state)
+{
+	state.resize(_particleCount);
+	_initialPositionBuffer.getData(state.positions);
+	_initialSpeedBuffer.getData(state.speeds);
+}
+
+const ParticleArrays& GravitySimulation::getInitialCPUParticles()
+{
+	if (_initialCPUParticles.size() != _particleCount) {
+		ParticleState state;
+		downloadInitialState(state);
+		_initialCPUParticles.assign(state);
 	}
+	return _initialCPUParticles;
+}
 
-	_positionBuffer.setData(pos);
-	_speedBuffer.setData(speed);
+//Brings the half-step speeds of the GPU up to date with dt, G and EPS2, with the kick programs of the current work group size.
+//The initial accelerations only depend on G and EPS2 so a new dt only repeats the kick with the stored ones.
+void GravitySimulation::updateHalfStepSpeeds()
+{
+	bool accelerationsReady = _initialAccelerationsReady && _accelerationG == _G && _accelerationEps2 == _eps2;
+	if (accelerationsReady && _halfStepReady && _halfStepDt == _dt) return;
+
+	//The accelerations of a dataset may be in its cache
+	unsigned long long key = hashBytes(&_G, sizeof(float), hashBytes(&_eps2, sizeof(float), _initialHash));
+	std::ostringstream oss;
+	oss << _cacheName << "." << std::hex << key << ".cache";
+	std::string cacheFilename = oss.str();
+	if (!accelerationsReady && !_cacheName.empty()) {
+		accelerationsReady = loadInitialAccelerations(cacheFilename, key);
+	}
+
+	_positionBuffer.copyFrom(_initialPositionBuffer);
+	_speedBuffer.copyFrom(_initialSpeedBuffer);
+	if (!accelerationsReady) {
+		_initialAccelerationBuffer.resize(_particleCount * 4, false);
+	}
 
-	//Compute half velocity for leapfrog integration
-	_halfVelocityProgram.bind();
-	glDispatchCompute(_initialParticles.size() / 128, 1, 1);
+	_kickStage = accelerationsReady ? 2 : 1; //Stored accelerations, or evaluate and store them
+	_stageCoefficient = 0.5f;
+	unsigned int index = computeProgramIndex();
+	_kickPrograms[index].bind();
+	glDispatchCompute(groupCount(index), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
-	//Update the initial conditions
-	std::vector<float> newSpeeds;
-	_speedBuffer.getData(newSpeeds);
+	//Keep the half-step speeds for the GPU. The initial conditions stay untouched since the CPU engine performs its own half-step.
+	_halfStepSpeedBuffer.copyFrom(_speedBuffer);
 
-	for (unsigned int i = 0; i < _initialParticles.size(); ++i) {
-		_initialParticles[i].speed.x = newSpeeds[i * 4 + 0];
-		_initialParticles[i].speed.y = newSpeeds[i * 4 + 1];
-		_initialParticles[i].speed.z = newSpeeds[i * 4 + 2];
+	if (!accelerationsReady && !_cacheName.empty()) {
+		saveInitialAccelerations(cacheFilename, key);
 	}
+
+	_kickStage = 0;
+	_accelerationG = _G;
+	_accelerationEps2 = _eps2;
+	_initialAccelerationsReady = true;
+	_halfStepDt = _dt;
+	_halfStepReady = true;
+}
+
+bool GravitySimulation::loadInitialAccelerations(const std::string& filename, unsigned long long key)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) return false;
+
+	unsigned long long fileKey = 0;
+	unsigned int count = 0;
+	file.read(reinterpret_cast<char*>(&fileKey), sizeof(fileKey));
+	file.read(reinterpret_cast<char*>(&count), sizeof(count));
+	if (!file || fileKey != key || count != _particleCount) return false;
+
+	std::vector<float> accelerations(count * 4);
+	file.read(reinterpret_cast<char*>(accelerations.data()), sizeof(float) * accelerations.size());
+	if (!file) return false;
+
+	_initialAccelerationBuffer.setData(accelerations);
+	std::cout << "Initial accelerations loaded from " << filename << "." << std::endl;
+	return true;
+}
+
+//Written once the readback lands, without stalling
+void GravitySimulation::saveInitialAccelerations(const std::string& filename, unsigned long long key)
+{
+	unsigned int count = _particleCount;
+	std::vector<const GPUBuffer<float>*> buffers{ &_initialAccelerationBuffer };
+
+	_readback.request(buffers, [filename, key, count](std::vector<std::vector<float>>& data) {
+		std::ofstream file(filename, std::ios::binary);
+		if (!file) {
+			std::cout << "Cannot write cache file " << filename << "." << std::endl;
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		file.write(reinterpret_cast<const char*>(data[0].data()), sizeof(float) * data[0].size());
+	});
 }
 
 //Runs the simulation for millis milliseconds and returns the fps during that time.
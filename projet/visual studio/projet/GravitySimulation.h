@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <functional>
 
 #include <vec3.hpp>
 #include <GL/glew.h>
@@ -10,12 +11,16 @@
 
 #include "ShaderProg.h"
 #include "GPUBuffer.h"
+#include "ParticleArrays.h"
+#include "CPUEngine.h"
+#include "GPUTree.h"
+#include "GPUReadback.h"
 
-struct Particle
+enum GPUSolver
 {
-	glm::vec3 pos;
-	glm::vec3 speed;
-	float mass;
+	GPU_DIRECT_SUM = 0, //Tiled O(N^2) shaders
+	GPU_BARNES_HUT, //GPUTree, for the leapfrog and the compositions. The Hermite and adaptive programs keep the direct sum.
+	GPU_SOLVER_COUNT
 };
 
 class GravitySimulation
@@ -30,6 +35,9 @@ public:
 	void render();
 	void playPause();
 	void benchmark();
+	void printEnergy(); //On the GPU the energy is printed once the state is read back, without stalling the simulation
+	void saveSnapshot(const std::string& filename); //Same
+	void flushReadbacks() { _readback.finish(); } //Waits for the pending GPU readbacks and runs their callbacks
 
 	void setMVP(const glm::mat4x4* MVP);
 	void setDt(float dt) { _dt = dt; }
@@ -37,35 +45,128 @@ public:
 	void setEps2(float eps2) { _eps2 = eps2; }
 	void setOnGPU(bool onGPU);
 	void setGroupSize(unsigned int groupSize) { _currentComputeProgramIndex = groupSize; } //new group size = 2^groupSize
-	void setOptimizationLevel(unsigned int level) { _opLevel = level; }
+	void setOptimizationLevel(unsigned int level) { _opLevel = level; _CPUEngine.setOptimizationLevel(level); }
 	void setOpacity(float opacity) { _opacity = opacity; }
+	void setThreadCount(unsigned int threadCount) { _CPUEngine.setThreadCount(threadCount); } //0 = one thread per hardware core
+	void setCPUSolver(unsigned int solver) { _CPUEngine.setSolver(solver); } //One of CPUSolver
+	void setCPUPrecision(unsigned int precision) { _CPUEngine.setPrecision(precision); } //One of CPUPrecision
+	void setIntegrator(unsigned int integrator); //One of CPUIntegrator, the GPU runs all but the block time steps
+	void setGPUSolver(unsigned int solver) { if (solver < GPU_SOLVER_COUNT) _GPUSolver = solver; } //One of GPUSolver
+	void setTheta(float theta) { _CPUEngine.setTheta(theta); _GPUTree.setTheta(theta); } //Opening angle of the tree solvers
+	void setTreeReuse(float maxGrowth, unsigned int listReuse) { _CPUEngine.setTreeReuse(maxGrowth, listReuse); } //See CPUEngine
+	void setFMMOrder(unsigned int order) { _CPUEngine.setFMMOrder(order); } //Expansion order of the FMM solver
+	void setMeshSize(unsigned int size) { _CPUEngine.setMeshSize(size); } //Particle mesh resolution per axis
+	void setMassAssignment(unsigned int assignment) { _CPUEngine.setMassAssignment(assignment); } //One of MassAssignment
+	void setReorderInterval(unsigned int ticks); //Ticks between two Morton reorderings of the particles, 0 to disable
+	void setEnergyInterval(unsigned int ticks) { _energyInterval = ticks; } //Ticks between two printed energies, 0 to disable
+	void setSnapshotInterval(unsigned int ticks) { _snapshotInterval = ticks; } //Ticks between two snapshot_<tick>.dat, 0 to disable
+	//Adaptive time step of accuracy eta, Dt becoming the largest step, or the fixed Dt when eta is 0.
+	//The GPU only adapts the leapfrog, its other integrators keep the fixed Dt.
+	void setAdaptiveTimeStep(float eta);
 
-	bool isOnGPU() const { return _onGPU; }
-	unsigned int getParticleCount() const { return _initialParticles.size(); }
-	unsigned int getGroupSize() const { return (1 << _currentComputeProgramIndex); }
+	bool isOnGPU() const { return _onGPU && !_leavingGPU; }
+	unsigned int getParticleCount() const { return _particleCount; }
+	unsigned int getGroupSize() const { return (1 << computeProgramIndex()); } //Effective size, raised when the dispatch would exceed the work group limit
+	unsigned int getThreadCount() const { return _CPUEngine.getThreadCount(); }
+	double getForceEvaluationsPerParticle() const { return _CPUEngine.getForceEvaluationsPerParticle(); }
+	double getTimeStep() const; //Time step of the last tick
 private:
 	void integrateCPU();
-	glm::vec3 computeAccelCPU(const Particle& p) const;
 	void generateShaderSources(const std::string& baseFilename, unsigned int n, std::vector<std::string>& shaderSources) const;
 	void generatePrograms(const std::vector<std::string>& shaderSources);
-	void computeHalfVelocity();
+	void generateComputePrograms(const std::string& baseFilename, std::vector<ShaderProg>& programs);
+	unsigned int computeProgramIndex() const; //Work group size of the dispatches, 2^index
+	unsigned int groupCount(unsigned int programIndex) const; //Work groups covering every particle
+	void hermiteTickGPU();
+	void compositionTickGPU(const Composition& composition);
+	void treeTickGPU();
+	void adaptiveTickGPU();
+	bool isAdaptiveOnGPU() const;
+	void clearCriterion();
+	double readCriterion();
+	bool hasSynchronizedSpeeds() const; //False for the leapfrogs, whose speeds are half a step ahead of the positions
+	double currentEnergy();
+	void setInitialState(const ParticleState& state, const std::string& cacheName);
+	void downloadInitialState(ParticleState& state);
+	const ParticleArrays& getInitialCPUParticles();
+	void updateHalfStepSpeeds();
+	void resetGPUState(); //Initial state into the GPU buffers, half-stepped for the leapfrogs
+	bool loadInitialAccelerations(const std::string& filename, unsigned long long key);
+	void saveInitialAccelerations(const std::string& filename, unsigned long long key);
+	void uploadParticles(const ParticleArrays& particles);
+	void uploadState(const std::vector<float>& positions, const std::vector<float>& speeds, const std::vector<unsigned int>& ids);
+	void resizeGPUState(const std::vector<unsigned int>& ids);
+	void downloadParticles(ParticleArrays& particles);
+	void requestParticles(const std::function<void(ParticleArrays&)>& callback);
+	void writeSnapshot(const std::string& filename, const ParticleArrays& particles) const;
+	void writeEnergy(const ParticleArrays& particles, unsigned int tick);
+	void reorderGPU();
+	void swapStateBuffers();
 	double runFor(unsigned long millis);
+	void benchmarkIntegrators(std::ostream& file, const std::string& device);
 
-	std::vector<Particle> _initialParticles;
-	std::vector<Particle> _CPUParticles;
+	unsigned int _particleCount;
+	ParticleArrays _initialCPUParticles; //Initial conditions of the CPU engine, read back from the GPU the first time they are needed
+	ParticleState _transferState; //Packing of the CPU particles for the GPU, kept to reuse its storage
+	ParticleArrays _CPUParticles;
+	CPUEngine _CPUEngine;
 
 	bool _onGPU; //True when the simulation takes place on the GPU, false when it takes place on the CPU.
 	bool _paused;
 	bool _initialTick; //True for the first iteration. Used to compute the first velocity step of the leapfrog integrator.
+	bool _leavingGPU; //The GPU state is being read back to continue on the CPU, the GPU does not tick meanwhile
+	unsigned int _switchGeneration; //Counts the switches from the GPU, only the readback of the latest one is installed
+	unsigned int _tickCount; //Ticks since the last reset
+	unsigned int _energyInterval;
+	unsigned int _snapshotInterval;
 
 	ShaderProg _GPURenderProgram;
 	ShaderProg _CPURenderProgram;
 	unsigned int _currentComputeProgramIndex;
+	GLint _maxGroupCount; //Largest number of work groups of a dispatch
 	std::vector<ShaderProg> _computePrograms; //One program per shader and one shader per compute shader work group size. work group size = 2 ^ index
-	ShaderProg _halfVelocityProgram;
+	std::string _cacheName; //Dataset file of the initial state, empty when its accelerations are not cached
+	unsigned long long _initialHash; //FNV-1a hash of the initial positions and masses
+	bool _initialAccelerationsReady;
+	float _accelerationG; //G and EPS2 of the initial accelerations
+	float _accelerationEps2;
+	bool _halfStepReady;
+	float _halfStepDt; //dt of the half-step speeds
+	std::vector<ShaderProg> _hermitePrograms; //Hermite integrator, one program per work group size like _computePrograms
+	unsigned int _hermiteStage; //Stage uniform of the Hermite programs
+	bool _GPUHermiteReady; //The GPU acceleration and jerk buffers match the positions and speeds
+	std::vector<ShaderProg> _kickPrograms; //Stages of the composition integrators, one program per work group size
+	std::vector<ShaderProg> _driftPrograms;
+	float _stageCoefficient; //Coefficient uniform of the kick and drift programs
+	unsigned int _kickStage; //Stage uniform of the kick programs, 1 and 2 taking the leapfrog half-step
+	std::vector<ShaderProg> _adaptivePrograms; //Leapfrog with an adaptive time step, one program per work group size
+	unsigned int _adaptiveStage;
+	float _GPUTimeStep; //timeStep uniform of the adaptive programs
+	bool _GPUForcesReady; //The GPU acceleration buffer matches the positions
+	double _GPUCriterion; //tau at the current positions
+	TimeStepController _GPUTimeStepController;
+	GPUTree _GPUTree;
+	ShaderProg _reorderProgram; //Gathers the GPU state along the Morton order sorted by the tree
+	unsigned int _GPUSolver;
 
-	GPUBuffer<float> _positionBuffer;
+	GPUBuffer<float> _positionBuffer; //Completed state, bound to 0 and 1 for every program and for gpu.vs
 	GPUBuffer<float> _speedBuffer;
+	GPUBuffer<float> _nextPositionBuffer; //State written by the base programs, bound to 15 and 16, swapped in once complete
+	GPUBuffer<float> _nextSpeedBuffer;
+	GPUBuffer<float> _initialPositionBuffer; //Initial conditions, copied to the state buffers by reset()
+	GPUBuffer<float> _initialSpeedBuffer;
+	GPUBuffer<float> _halfStepSpeedBuffer; //Initial speeds after the GPU euler half-step
+	GPUBuffer<float> _initialAccelerationBuffer; //Accelerations of the initial positions, the half-step being a kick with them
+	GPUBuffer<float> _accelerationBuffer; //Hermite integrator only
+	GPUBuffer<float> _jerkBuffer;
+	GPUBuffer<float> _predictedPositionBuffer;
+	GPUBuffer<float> _predictedSpeedBuffer;
+	GPUBuffer<unsigned int> _criterionBuffer; //Adaptive time step only, mapped since it is read back every tick
+	GPUBuffer<float> _savedPositionBuffer; //State at the start of an adaptive step, restored before retaking it
+	GPUBuffer<float> _savedSpeedBuffer;
+	GPUBuffer<float> _savedAccelerationBuffer;
+	GPUBuffer<float> _idBuffer; //Original index of the particles in the state buffers, as uint bits so it is read back with them
+	GPUBuffer<float> _nextIdBuffer; //Ids written by the reorder, swapped in once complete
 	
 	GPUBuffer<float> _vao; //Used for instanced rendering when positions are already on the GPU.
 
@@ -73,8 +174,12 @@ private:
 	float _dt; //Time step between two ticks
 	float _G; //Gravitationnal constant
 	float _eps2; //Softening coefficient used in gravity acceleration computation
-	unsigned int _opLevel; //Niveau d'optimisation dans le GPU (1 = naif, 2 = memory optimized, 3 =  memory optimized + loop unrolling)
+	unsigned int _opLevel; //Niveau d'optimisation dans le GPU et le CPU (0 = naif, 1 = memory optimized, 2 =  memory optimized + loop unrolling)
 	float _opacity; //Opacit des particules
+
+	unsigned int _reorderInterval; //Ticks between two Morton reorderings
+	unsigned int _GPUTicksSinceReorder;
+	GPUReadback _readback;
 };
 
 #endif
\ No newline at end of file
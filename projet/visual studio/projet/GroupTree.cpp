@@ -0,0 +1,258 @@
+#include "GroupTree.h"
+#include "DirectSum.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+GroupTreeSolver::GroupTreeSolver()
+	: _theta(0.5f), _leafSize(16), _groupSize(64), _maxGrowth(0.0f), _listReuse(1), _evaluation(0), _treeEvaluation(0),
+	_meanListLength(0.0), _walkFraction(1.0)
+{
+
+}
+
+void GroupTreeSolver::computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	updateTree(p, pool);
+	evaluate(p, nullptr, G, eps2, pool);
+}
+
+void GroupTreeSolver::computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2, ThreadPool& pool)
+{
+	updateTree(p, pool);
+
+	_isTarget.assign(p.size(), 0);
+	for (size_t k = 0; k < targets.size(); ++k) {
+		_isTarget[targets[k]] = 1;
+	}
+
+	evaluate(p, &_isTarget, G, eps2, pool);
+}
+
+//The groups and their lists survive a refit since it keeps the topology
+void GroupTreeSolver::updateTree(const ParticleArrays& p, ThreadPool& pool)
+{
+	++_evaluation;
+	if (_tree.update(p, _leafSize, _maxGrowth, pool)) {
+		buildGroups();
+		_treeEvaluation = _evaluation;
+	}
+}
+
+//Largest nodes with at most _groupSize particles, children being pushed in reverse so the groups come out in tree order
+void GroupTreeSolver::buildGroups()
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+
+	_groups.clear();
+	if (nodes.empty()) return;
+
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty()) {
+		unsigned int index = stack.back();
+		stack.pop_back();
+
+		const OctreeNode& node = nodes[index];
+		if (node.end - node.begin <= _groupSize || node.childCount == 0) {
+			_groups.push_back(index);
+		}
+		else {
+			for (unsigned int c = node.childCount; c > 0; --c) {
+				stack.push_back(node.firstChild + c - 1);
+			}
+		}
+	}
+}
+
+//Adds the quadrupole terms of the cells G (2.5 (d.Q.d) d / r^7 - Q.d / r^5), d going from the target to the cell center of mass.
+//nTargets has to be a multiple of SIMD_WIDTH.
+static void quadrupoleAccel(const float* tx, const float* ty, const float* tz, size_t nTargets,
+	const float* cx, const float* cy, const float* cz, const AlignedFloatArray* quad, size_t nCells,
+	float G, float eps2, float* ax, float* ay, float* az)
+{
+	vfloat vG = vset1(G);
+	vfloat vEps2 = vset1(eps2);
+	vfloat vFactor = vset1(2.5f);
+
+	for (size_t i = 0; i < nTargets; i += SIMD_WIDTH) {
+		vfloat px = vload(tx + i), py = vload(ty + i), pz = vload(tz + i);
+		vfloat accX = vzero(), accY = vzero(), accZ = vzero();
+
+		for (size_t c = 0; c < nCells; ++c) {
+			vfloat dx = vsub(vset1(cx[c]), px);
+			vfloat dy = vsub(vset1(cy[c]), py);
+			vfloat dz = vsub(vset1(cz[c]), pz);
+
+			vfloat qxx = vset1(quad[0][c]), qyy = vset1(quad[1][c]), qzz = vset1(quad[2][c]);
+			vfloat qxy = vset1(quad[3][c]), qxz = vset1(quad[4][c]), qyz = vset1(quad[5][c]);
+			vfloat qdx = vfmadd(qxx, dx, vfmadd(qxy, dy, vmul(qxz, dz)));
+			vfloat qdy = vfmadd(qxy, dx, vfmadd(qyy, dy, vmul(qyz, dz)));
+			vfloat qdz = vfmadd(qxz, dx, vfmadd(qyz, dy, vmul(qzz, dz)));
+			vfloat dqd = vfmadd(dx, qdx, vfmadd(dy, qdy, vmul(dz, qdz)));
+
+			vfloat distSqr = vfmadd(dx, dx, vfmadd(dy, dy, vfmadd(dz, dz, vEps2)));
+			vfloat invDist = vrsqrt(distSqr);
+			vfloat invDist2 = vmul(invDist, invDist);
+			vfloat invDist5 = vmul(invDist, vmul(invDist2, invDist2));
+			vfloat s = vmul(vmul(vFactor, dqd), vmul(invDist5, invDist2));
+
+			accX = vfnmadd(invDist5, qdx, vfmadd(s, dx, accX));
+			accY = vfnmadd(invDist5, qdy, vfmadd(s, dy, accY));
+			accZ = vfnmadd(invDist5, qdz, vfmadd(s, dz, accZ));
+		}
+
+		vstore(ax + i, vfmadd(accX, vG, vload(ax + i)));
+		vstore(ay + i, vfmadd(accY, vG, vload(ay + i)));
+		vstore(az + i, vfmadd(accZ, vG, vload(az + i)));
+	}
+}
+
+void GroupTreeSolver::evaluate(ParticleArrays& p, const std::vector<char>* isTarget, float G, float eps2, ThreadPool& pool)
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+
+	_workspaces.resize(pool.getThreadCount());
+	std::vector<double> threadLength(pool.getThreadCount(), 0.0);
+	std::vector<size_t> threadGroups(pool.getThreadCount(), 0);
+	std::vector<size_t> threadWalks(pool.getThreadCount(), 0);
+	bool keepLists = _listReuse > 1;
+	if (keepLists) {
+		_lists.resize(_groups.size());
+	}
+	std::atomic<size_t> nextGroup(0);
+
+	pool.run([&](unsigned int index, unsigned int) {
+		Workspace& w = _workspaces[index];
+
+		for (size_t g = nextGroup++; g < _groups.size(); g = nextGroup++) {
+			const OctreeNode& group = nodes[_groups[g]];
+
+			if (isTarget) {
+				bool found = false;
+				for (unsigned int k = group.begin; k < group.end && !found; ++k) {
+					found = (*isTarget)[indices[k]] != 0;
+				}
+				if (!found) continue;
+			}
+
+			//Group particles, padded with copies of the last one to a multiple of SIMD_WIDTH
+			size_t count = group.end - group.begin;
+			size_t padded = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+			w.tx.resize(padded); w.ty.resize(padded); w.tz.resize(padded);
+			w.ax.assign(padded, 0.0f); w.ay.assign(padded, 0.0f); w.az.assign(padded, 0.0f);
+			for (size_t k = 0; k < padded; ++k) {
+				unsigned int i = indices[group.begin + std::min(k, count - 1)];
+				w.tx[k] = p.x[i]; w.ty[k] = p.y[i]; w.tz[k] = p.z[i];
+			}
+
+			//A kept list is reused while it is younger than _listReuse evaluations and the tree it was walked in is still refitted
+			InteractionList& list = keepLists ? _lists[g] : w.list;
+			if (!keepLists || list.evaluation < _treeEvaluation || _evaluation - list.evaluation >= _listReuse) {
+				walk(group, list, w.stack);
+				list.evaluation = _evaluation;
+				++threadWalks[index];
+			}
+			gather(p, list, w);
+
+			directSumAccel(w.tx.data(), w.ty.data(), w.tz.data(), padded,
+				w.sx.data(), w.sy.data(), w.sz.data(), w.sm.data(), w.sx.size(), G, eps2, w.ax.data(), w.ay.data(), w.az.data());
+			quadrupoleAccel(w.tx.data(), w.ty.data(), w.tz.data(), padded,
+				w.cx.data(), w.cy.data(), w.cz.data(), w.quad, w.cx.size(), G, eps2, w.ax.data(), w.ay.data(), w.az.data());
+
+			for (size_t k = 0; k < count; ++k) {
+				unsigned int i = indices[group.begin + k];
+				if (isTarget && !(*isTarget)[i]) continue;
+				p.ax[i] = w.ax[k];
+				p.ay[i] = w.ay[k];
+				p.az[i] = w.az[k];
+			}
+
+			threadLength[index] += static_cast<double>(w.sx.size());
+			++threadGroups[index];
+		}
+	});
+
+	double length = 0.0;
+	size_t groups = 0, walks = 0;
+	for (unsigned int t = 0; t < threadLength.size(); ++t) {
+		length += threadLength[t];
+		groups += threadGroups[t];
+		walks += threadWalks[t];
+	}
+	_meanListLength = groups > 0 ? length / groups : 0.0;
+	_walkFraction = groups > 0 ? static_cast<double>(walks) / groups : 1.0;
+}
+
+//Walks the tree with the bounding box of the group: a cell is accepted when size / (d - delta) < theta for d the distance
+//from its center of mass to the box, hence for every particle of the group
+void GroupTreeSolver::walk(const OctreeNode& group, InteractionList& list, std::vector<unsigned int>& stack) const
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+
+	glm::vec3 boxCenter = 0.5f * (group.boxMin + group.boxMax);
+	glm::vec3 halfExtent = 0.5f * (group.boxMax - group.boxMin);
+
+	list.leaves.clear();
+	list.cells.clear();
+
+	float invTheta = 1.0f / _theta;
+
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty()) {
+		unsigned int index = stack.back();
+		const OctreeNode& node = nodes[index];
+		stack.pop_back();
+
+		glm::vec3 d = glm::max(glm::abs(node.com - boxCenter) - halfExtent, glm::vec3(0.0f));
+		float d2 = d.x * d.x + d.y * d.y + d.z * d.z;
+		float openDist = node.size * invTheta + node.delta;
+
+		if (d2 > openDist * openDist) {
+			list.cells.push_back(index);
+		}
+		else if (node.childCount == 0) {
+			list.leaves.push_back(index);
+		}
+		else {
+			for (unsigned int c = 0; c < node.childCount; ++c) {
+				stack.push_back(node.firstChild + c);
+			}
+		}
+	}
+}
+
+//Copies the leaf particles and the cell moments of a list into the kernel buffers
+void GroupTreeSolver::gather(const ParticleArrays& p, const InteractionList& list, Workspace& w) const
+{
+	const std::vector<OctreeNode>& nodes = _tree.getNodes();
+	const std::vector<unsigned int>& indices = _tree.getIndices();
+
+	w.sx.clear(); w.sy.clear(); w.sz.clear(); w.sm.clear();
+	w.cx.clear(); w.cy.clear(); w.cz.clear();
+	for (unsigned int q = 0; q < 6; ++q) {
+		w.quad[q].clear();
+	}
+
+	for (size_t l = 0; l < list.leaves.size(); ++l) {
+		const OctreeNode& leaf = nodes[list.leaves[l]];
+		for (unsigned int k = leaf.begin; k < leaf.end; ++k) {
+			unsigned int j = indices[k];
+			w.sx.push_back(p.x[j]); w.sy.push_back(p.y[j]); w.sz.push_back(p.z[j]);
+			w.sm.push_back(p.mass[j]);
+		}
+	}
+
+	for (size_t c = 0; c < list.cells.size(); ++c) {
+		const OctreeNode& node = nodes[list.cells[c]];
+		w.sx.push_back(node.com.x); w.sy.push_back(node.com.y); w.sz.push_back(node.com.z);
+		w.sm.push_back(node.mass);
+		w.cx.push_back(node.com.x); w.cy.push_back(node.com.y); w.cz.push_back(node.com.z);
+		for (unsigned int q = 0; q < 6; ++q) {
+			w.quad[q].push_back(node.quad[q]);
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef GROUPTREE_H
+#define GROUPTREE_H
+
+#include "ForceSolver.h"
+#include "Octree.h"
+
+//Tree solver walking the tree once per group of spatially close particles (Barnes 1990, as in Bonsai and ChaNGa).
+//Groups are the largest tree nodes holding at most groupSize particles. A group walk accepts the cells far enough from the whole
+//group bounding box and gathers them with the particles of the opened leaves in an interaction list shared by the group, which is then
+//evaluated by the SIMD direct sum kernel (particles and cell monopoles) and a vectorized quadrupole kernel. Groups are dealt dynamically
+//to the threads since their lists have very different lengths.
+//Lists are stored as node indices, so with a refitted tree a list can be reused for a few evaluations and only gathered again
+//from the current particles and moments.
+class GroupTreeSolver : public ForceSolver
+{
+public:
+	GroupTreeSolver();
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+	//Only the groups containing targets are walked and only the targets are written
+	virtual void computeAccelerations(ParticleArrays& p, const std::vector<unsigned int>& targets, float G, float eps2, ThreadPool& pool);
+
+	void setTheta(float theta) { _theta = theta; }
+	float getTheta() const { return _theta; }
+	void setLeafSize(unsigned int leafSize) { _leafSize = leafSize; }
+	void setGroupSize(unsigned int groupSize) { _groupSize = groupSize > 0 ? groupSize : 1; }
+	//The tree is refitted instead of rebuilt until a cell grows by more than maxGrowth, 0 rebuilding it at every evaluation
+	void setMaxGrowth(float maxGrowth) { _maxGrowth = maxGrowth; }
+	//Number of evaluations served by a walk, the tree being refitted in between. 1 walks at every evaluation.
+	void setListReuse(unsigned int evaluations) { _listReuse = evaluations > 0 ? evaluations : 1; }
+	virtual void invalidate() { _tree.invalidate(); }
+
+	//Mean length of the interaction lists of the last evaluation, particles and cells
+	double getMeanListLength() const { return _meanListLength; }
+	//Fraction of the groups of the last evaluation whose list was walked rather than reused
+	double getWalkFraction() const { return _walkFraction; }
+
+private:
+	//Interaction list of a group as node indices
+	struct InteractionList
+	{
+		std::vector<unsigned int> leaves; //Opened leaves, whose particles interact directly
+		std::vector<unsigned int> cells; //Accepted cells
+		unsigned int evaluation; //Evaluation of the walk
+
+		InteractionList() : evaluation(0) {}
+	};
+
+	//Gathered interaction list and group buffers of one thread
+	struct Workspace
+	{
+		AlignedFloatArray sx, sy, sz, sm; //Point masses: leaf particles then cell monopoles
+		AlignedFloatArray cx, cy, cz, quad[6]; //Quadrupoles of the accepted cells
+		AlignedFloatArray tx, ty, tz, ax, ay, az; //Group particles
+		InteractionList list; //Used when the lists are not kept
+		std::vector<unsigned int> stack;
+	};
+
+	void updateTree(const ParticleArrays& p, ThreadPool& pool);
+	void buildGroups();
+	void evaluate(ParticleArrays& p, const std::vector<char>* isTarget, float G, float eps2, ThreadPool& pool);
+	void walk(const OctreeNode& group, InteractionList& list, std::vector<unsigned int>& stack) const;
+	void gather(const ParticleArrays& p, const InteractionList& list, Workspace& w) const;
+
+	Octree _tree;
+	std::vector<unsigned int> _groups; //Group nodes, in tree order
+	std::vector<InteractionList> _lists; //One per group, kept when the lists are reused
+	std::vector<Workspace> _workspaces;
+	std::vector<char> _isTarget;
+	float _theta; //Opening angle
+	unsigned int _leafSize; //Maximum number of particles in a leaf
+	unsigned int _groupSize; //Maximum number of particles in a group
+	float _maxGrowth;
+	unsigned int _listReuse;
+	unsigned int _evaluation; //Counts the evaluations, from 1
+	unsigned int _treeEvaluation; //Evaluation of the last rebuild, older lists being stale
+	double _meanListLength;
+	double _walkFraction;
+};
+
+#endif
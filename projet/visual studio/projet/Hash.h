@@ -0,0 +1,18 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+
+static const unsigned long long FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+//64-bit FNV-1a of size bytes, continuing from hash to combine several values
+inline unsigned long long hashBytes(const void* data, size_t size, unsigned long long hash = FNV_OFFSET_BASIS)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include "Morton.h"
+
+#include <algorithm>
+
+static const unsigned int KEY_BITS = MORTON_BITS;
+static const unsigned int RADIX_BITS = 8;
+static const unsigned int RADIX_SIZE = 1 << RADIX_BITS;
+static const size_t PARALLEL_SORT_SIZE = 1 << 14; //Below, the passes are too short to pay for the synchronization
+
+//Spreads the 21 low bits of v so that two zero bits separate each of them
+static uint64_t spreadBits(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8) & 0x100f00f00f00f00fULL;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2) & 0x1249249249249249ULL;
+	return v;
+}
+
+uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z)
+{
+	return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+void computeMortonKeys(const ParticleArrays& p, std::vector<uint64_t>& keys, ThreadPool& pool)
+{
+	glm::vec3 origin;
+	float extent;
+	computeMortonKeys(p, keys, pool, origin, extent);
+}
+
+void computeMortonKeys(const ParticleArrays& p, std::vector<uint64_t>& keys, ThreadPool& pool, glm::vec3& origin, float& extent)
+{
+	size_t n = p.size();
+	keys.resize(n);
+	origin = glm::vec3(0.0f);
+	extent = 0.0f;
+	if (n == 0) return;
+
+	//Bounding box, reduced from one partial box per thread
+	std::vector<float> bounds(pool.getThreadCount() * 6);
+	pool.run([&](unsigned int index, unsigned int count) {
+		size_t begin, end;
+		ThreadPool::splitRange(n, index, count, 64, begin, end);
+
+		float* b = &bounds[index * 6];
+		b[0] = b[1] = b[2] = 1e30f;
+		b[3] = b[4] = b[5] = -1e30f;
+		for (size_t i = begin; i < end; ++i) {
+			b[0] = std::min(b[0], p.x[i]); b[3] = std::max(b[3], p.x[i]);
+			b[1] = std::min(b[1], p.y[i]); b[4] = std::max(b[4], p.y[i]);
+			b[2] = std::min(b[2], p.z[i]); b[5] = std::max(b[5], p.z[i]);
+		}
+	});
+
+	float minX = 1e30f, minY = 1e30f, minZ = 1e30f, maxExtent = 0.0f;
+	float maxX = -1e30f, maxY = -1e30f, maxZ = -1e30f;
+	for (unsigned int t = 0; t < pool.getThreadCount(); ++t) {
+		const float* b = &bounds[t * 6];
+		minX = std::min(minX, b[0]); minY = std::min(minY, b[1]); minZ = std::min(minZ, b[2]);
+		maxX = std::max(maxX, b[3]); maxY = std::max(maxY, b[4]); maxZ = std::max(maxZ, b[5]);
+	}
+	maxExtent = std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ));
+	origin = glm::vec3(minX, minY, minZ);
+	extent = maxExtent;
+
+	//Cubic grid so the curve does not favor an axis
+	float gridMax = static_cast<float>((1 << KEY_BITS) - 1);
+	float scale = maxExtent > 0.0f ? gridMax / maxExtent : 0.0f;
+
+	pool.parallelFor(n, 64, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t qx = static_cast<uint32_t>(std::min(gridMax, (p.x[i] - minX) * scale));
+			uint32_t qy = static_cast<uint32_t>(std::min(gridMax, (p.y[i] - minY) * scale));
+			uint32_t qz = static_cast<uint32_t>(std::min(gridMax, (p.z[i] - minZ) * scale));
+			keys[i] = mortonKey(qx, qy, qz);
+		}
+	});
+}
+
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<unsigned int>& order)
+{
+	size_t n = keys.size();
+	order.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		order[i] = static_cast<unsigned int>(i);
+	}
+
+	std::vector<uint64_t> keysTmp(n);
+	std::vector<unsigned int> orderTmp(n);
+	size_t count[RADIX_SIZE];
+
+	for (unsigned int shift = 0; shift < 3 * KEY_BITS; shift += RADIX_BITS) {
+		std::fill(count, count + RADIX_SIZE, 0);
+		for (size_t i = 0; i < n; ++i) {
+			++count[(keys[i] >> shift) & (RADIX_SIZE - 1)];
+		}
+
+		//Every key has the same digit, the pass would not move anything
+		if (n == 0 || count[(keys[0] >> shift) & (RADIX_SIZE - 1)] == n) continue;
+
+		size_t offset = 0;
+		for (unsigned int d = 0; d < RADIX_SIZE; ++d) {
+			size_t c = count[d];
+			count[d] = offset;
+			offset += c;
+		}
+
+		for (size_t i = 0; i < n; ++i) {
+			size_t destination = count[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+			keysTmp[destination] = keys[i];
+			orderTmp[destination] = order[i];
+		}
+
+		keys.swap(keysTmp);
+		order.swap(orderTmp);
+	}
+}
+
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<unsigned int>& order, ThreadPool& pool)
+{
+	size_t n = keys.size();
+	unsigned int threadCount = pool.getThreadCount();
+	if (n < PARALLEL_SORT_SIZE || threadCount == 1) {
+		radixSortKeys(keys, order);
+		return;
+	}
+
+	order.resize(n);
+	std::vector<uint64_t> keysTmp(n);
+	std::vector<unsigned int> orderTmp(n);
+	std::vector<size_t> offsets(threadCount * RADIX_SIZE);
+	bool skip = false;
+	unsigned int passes = 0;
+
+	//All the passes run in one task, separated by barriers. Every thread swaps its own source and destination pointers.
+	pool.run([&](unsigned int index, unsigned int count) {
+		size_t begin, end;
+		ThreadPool::splitRange(n, index, count, 64, begin, end);
+
+		for (size_t i = begin; i < end; ++i) {
+			order[i] = static_cast<unsigned int>(i);
+		}
+
+		uint64_t* srcKeys = keys.data();
+		uint64_t* dstKeys = keysTmp.data();
+		unsigned int* srcOrder = order.data();
+		unsigned int* dstOrder = orderTmp.data();
+		size_t* offset = &offsets[index * RADIX_SIZE];
+
+		for (unsigned int shift = 0; shift < 3 * KEY_BITS; shift += RADIX_BITS) {
+			std::fill(offset, offset + RADIX_SIZE, 0);
+			for (size_t i = begin; i < end; ++i) {
+				++offset[(srcKeys[i] >> shift) & (RADIX_SIZE - 1)];
+			}
+			pool.barrier();
+
+			if (index == 0) {
+				//Every key has the same digit, the pass would not move anything
+				size_t first = (srcKeys[0] >> shift) & (RADIX_SIZE - 1);
+				size_t total = 0;
+				for (unsigned int t = 0; t < count; ++t) {
+					total += offsets[t * RADIX_SIZE + first];
+				}
+				skip = total == n;
+
+				//Digit major, thread minor
+				size_t sum = 0;
+				for (unsigned int d = 0; d < RADIX_SIZE && !skip; ++d) {
+					for (unsigned int t = 0; t < count; ++t) {
+						size_t c = offsets[t * RADIX_SIZE + d];
+						offsets[t * RADIX_SIZE + d] = sum;
+						sum += c;
+					}
+				}
+				passes += skip ? 0 : 1;
+			}
+			pool.barrier();
+
+			//skip is written again only after the next counting barrier, hence after every thread has read it
+			if (skip) continue;
+
+			for (size_t i = begin; i < end; ++i) {
+				size_t destination = offset[(srcKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+				dstKeys[destination] = srcKeys[i];
+				dstOrder[destination] = srcOrder[i];
+			}
+			std::swap(srcKeys, dstKeys);
+			std::swap(srcOrder, dstOrder);
+			pool.barrier(); //The next pass counts what the other threads scattered
+		}
+	});
+
+	if (passes % 2 == 1) {
+		keys.swap(keysTmp);
+		order.swap(orderTmp);
+	}
+}
+
+void mortonOrder(const ParticleArrays& p, std::vector<unsigned int>& order, ThreadPool& pool)
+{
+	std::vector<uint64_t> keys;
+	computeMortonKeys(p, keys, pool);
+	radixSortKeys(keys, order, pool);
+}
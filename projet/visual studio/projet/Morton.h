@@ -0,0 +1,33 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <vec3.hpp>
+
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+
+static const unsigned int MORTON_BITS = 21; //Per axis
+
+//Interleaves the 21 low bits of x, y and z into a 63-bit Morton key, x taking the lowest bit of every triplet
+uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z);
+
+//Computes the Morton key of every particle, the positions being quantized on a 2^21 grid over their bounding cube
+void computeMortonKeys(const ParticleArrays& p, std::vector<uint64_t>& keys, ThreadPool& pool);
+//Same, also giving the grid: a position x is quantized to floor((x - origin) / extent * (2^21 - 1))
+void computeMortonKeys(const ParticleArrays& p, std::vector<uint64_t>& keys, ThreadPool& pool, glm::vec3& origin, float& extent);
+
+//LSD radix sort of keys, 8 bits per pass. order receives the permutation: order[k] is the former index of the k-th smallest key.
+//Passes where every key has the same digit are skipped, which makes small or low-entropy keys cheap.
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<unsigned int>& order);
+//Parallel version: every pass counts the digits of one contiguous range per thread, offsets come from a prefix sum over (digit, thread)
+//and each thread scatters its range, so the sort stays stable. Small arrays are sorted serially.
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<unsigned int>& order, ThreadPool& pool);
+
+//Permutation sorting the particles of p along the Morton curve, so particles close in space are close in memory
+void mortonOrder(const ParticleArrays& p, std::vector<unsigned int>& order, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,324 @@
+#include "Octree.h"
+
+#include "Morton.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include <vector_relational.hpp>
+
+static const unsigned int SUBTREES_PER_THREAD = 8; //Subtrees built in parallel, enough to balance the threads
+
+Octree::Octree()
+	: _topCount(0), _leafSize(16), _growth(1.0f)
+{
+
+}
+
+void Octree::build(const ParticleArrays& p, unsigned int leafSize, ThreadPool& pool)
+{
+	_leafSize = std::max(1u, leafSize);
+	_nodes.clear();
+	_subtreeBegin.clear();
+	_topCount = 0;
+
+	glm::vec3 origin;
+	float extent;
+	computeMortonKeys(p, _keys, pool, origin, extent);
+	radixSortKeys(_keys, _indices, pool);
+
+	unsigned int n = static_cast<unsigned int>(p.size());
+	if (n == 0) return;
+
+	//Cube of the Morton grid, so the particles of a cell are exactly the keys sharing its prefix
+	float gridMax = static_cast<float>((1 << MORTON_BITS) - 1);
+	float rootSize = extent > 0.0f ? static_cast<float>(1 << MORTON_BITS) / (gridMax / extent) : 1e-6f;
+
+	OctreeNode root;
+	root.center = origin + glm::vec3(0.5f * rootSize);
+	root.size = rootSize;
+	root.begin = 0;
+	root.end = n;
+	root.firstChild = 0;
+	root.childCount = 0;
+	_nodes.push_back(root);
+
+	//Top of the tree, split breadth first until the unsplit nodes are numerous enough to be dealt to the threads
+	std::vector<unsigned int> levels(1, 0);
+	unsigned int subtreeCount = SUBTREES_PER_THREAD * pool.getThreadCount();
+	unsigned int open = 0;
+	while (open < _nodes.size() && _nodes.size() - open < subtreeCount) {
+		unsigned int level = levels[open];
+		if (splitNode(_nodes, open, level)) {
+			levels.resize(_nodes.size(), level + 1);
+		}
+		++open;
+	}
+
+	_topCount = static_cast<unsigned int>(_nodes.size());
+	unsigned int frontier = _topCount - open;
+	if (_subtrees.size() < frontier) {
+		_subtrees.resize(frontier);
+	}
+
+	std::atomic<unsigned int> nextSubtree(0);
+	pool.run([&](unsigned int, unsigned int) {
+		for (unsigned int s = nextSubtree++; s < frontier; s = nextSubtree++) {
+			std::vector<OctreeNode>& subtree = _subtrees[s];
+			subtree.assign(1, _nodes[open + s]);
+			buildNode(subtree, 0, levels[open + s]);
+		}
+	});
+
+	//The subtrees are appended in order, node k > 0 of subtree s going to _subtreeBegin[s] + k - 1
+	_subtreeBegin.resize(frontier + 1);
+	_subtreeBegin[0] = _topCount;
+	for (unsigned int s = 0; s < frontier; ++s) {
+		_subtreeBegin[s + 1] = _subtreeBegin[s] + static_cast<unsigned int>(_subtrees[s].size()) - 1;
+	}
+	_nodes.resize(_subtreeBegin[frontier]);
+
+	nextSubtree = 0;
+	pool.run([&](unsigned int, unsigned int) {
+		for (unsigned int s = nextSubtree++; s < frontier; s = nextSubtree++) {
+			const std::vector<OctreeNode>& subtree = _subtrees[s];
+			unsigned int offset = _subtreeBegin[s] - 1;
+
+			for (size_t k = 0; k < subtree.size(); ++k) {
+				OctreeNode& node = _nodes[k == 0 ? open + s : offset + k];
+				node = subtree[k];
+				if (node.childCount > 0) {
+					node.firstChild += offset;
+				}
+			}
+		}
+	});
+
+	_cellSizes.resize(_nodes.size());
+	pool.parallelFor(_nodes.size(), 256, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			_cellSizes[k] = _nodes[k].size;
+		}
+	});
+}
+
+bool Octree::update(const ParticleArrays& p, unsigned int leafSize, float maxGrowth, ThreadPool& pool)
+{
+	bool sameTree = !_nodes.empty() && _indices.size() == p.size() && _leafSize == std::max(1u, leafSize);
+	if (maxGrowth >= 1.0f && sameTree) {
+		computeMoments(p, pool);
+		if (_growth <= maxGrowth) return false;
+	}
+
+	build(p, leafSize, pool);
+	computeMoments(p, pool);
+	return true;
+}
+
+void Octree::buildNode(std::vector<OctreeNode>& nodes, unsigned int nodeIndex, unsigned int level) const
+{
+	if (!splitNode(nodes, nodeIndex, level)) return;
+
+	unsigned int firstChild = nodes[nodeIndex].firstChild;
+	unsigned int childCount = nodes[nodeIndex].childCount;
+	for (unsigned int c = firstChild; c < firstChild + childCount; ++c) {
+		buildNode(nodes, c, level + 1);
+	}
+}
+
+//Returns false for a leaf
+bool Octree::splitNode(std::vector<OctreeNode>& nodes, unsigned int nodeIndex, unsigned int level) const
+{
+	OctreeNode node = nodes[nodeIndex]; //Copy since nodes grows below
+
+	if (node.end - node.begin <= _leafSize || level >= MORTON_BITS) {
+		return false;
+	}
+
+	//The keys of the node share their level high digits, its children split them on the next one
+	unsigned int shift = 3 * (MORTON_BITS - 1 - level);
+	uint64_t prefix = _keys[node.begin] & ~((uint64_t(8) << shift) - 1);
+	const uint64_t* keys = _keys.data();
+
+	//Non-empty children are pushed contiguously
+	unsigned int firstChild = static_cast<unsigned int>(nodes.size());
+	float childSize = 0.5f * node.size;
+	unsigned int begin = node.begin;
+	for (unsigned int o = 0; o < 8 && begin < node.end; ++o) {
+		unsigned int end = node.end;
+		if (o < 7) {
+			end = static_cast<unsigned int>(std::lower_bound(keys + begin, keys + node.end, prefix | (uint64_t(o + 1) << shift)) - keys);
+		}
+		if (end == begin) continue;
+
+		OctreeNode child;
+		child.center = node.center + 0.5f * childSize * glm::vec3((o & 1) ? 1.0f : -1.0f, (o & 2) ? 1.0f : -1.0f, (o & 4) ? 1.0f : -1.0f);
+		child.size = childSize;
+		child.begin = begin;
+		child.end = end;
+		child.firstChild = 0;
+		child.childCount = 0;
+		nodes.push_back(child);
+
+		begin = end;
+	}
+
+	nodes[nodeIndex].firstChild = firstChild;
+	nodes[nodeIndex].childCount = static_cast<unsigned int>(nodes.size()) - firstChild;
+	return true;
+}
+
+//Adds to quad the quadrupole of a point mass m located at d from the expansion center
+static void addPointQuadrupole(float* quad, float m, const glm::vec3& d)
+{
+	float d2 = d.x * d.x + d.y * d.y + d.z * d.z;
+	quad[0] += m * (3.0f * d.x * d.x - d2);
+	quad[1] += m * (3.0f * d.y * d.y - d2);
+	quad[2] += m * (3.0f * d.z * d.z - d2);
+	quad[3] += m * 3.0f * d.x * d.y;
+	quad[4] += m * 3.0f * d.x * d.z;
+	quad[5] += m * 3.0f * d.y * d.z;
+}
+
+//Subtrees in parallel, then the top nodes, children always coming first
+void Octree::computeMoments(const ParticleArrays& p, ThreadPool& pool)
+{
+	unsigned int subtreeCount = _subtreeBegin.empty() ? 0 : static_cast<unsigned int>(_subtreeBegin.size()) - 1;
+	std::atomic<unsigned int> nextSubtree(0);
+	std::vector<float> threadGrowth(pool.getThreadCount(), 1.0f);
+
+	pool.run([&](unsigned int index, unsigned int) {
+		for (unsigned int s = nextSubtree++; s < subtreeCount; s = nextSubtree++) {
+			for (unsigned int k = _subtreeBegin[s + 1]; k-- > _subtreeBegin[s];) {
+				threadGrowth[index] = std::max(threadGrowth[index], computeNodeMoments(p, k));
+			}
+		}
+	});
+
+	_growth = *std::max_element(threadGrowth.begin(), threadGrowth.end());
+	for (unsigned int k = _topCount; k-- > 0;) {
+		_growth = std::max(_growth, computeNodeMoments(p, k));
+	}
+}
+
+//Bounding box, mass, center of mass and quadrupole of a node whose children are done.
+//The cell is grown to contain the bounding box and the growth factor returned.
+float Octree::computeNodeMoments(const ParticleArrays& p, unsigned int nodeIndex)
+{
+	OctreeNode& node = _nodes[nodeIndex];
+	std::fill(node.quad, node.quad + 6, 0.0f);
+
+	float mass = 0.0f;
+	glm::vec3 weighted(0.0f);
+
+	if (node.childCount == 0) {
+		node.boxMin = glm::vec3(1e30f);
+		node.boxMax = glm::vec3(-1e30f);
+		for (unsigned int i = node.begin; i < node.end; ++i) {
+			unsigned int idx = _indices[i];
+			glm::vec3 pos(p.x[idx], p.y[idx], p.z[idx]);
+			mass += p.mass[idx];
+			weighted += p.mass[idx] * pos;
+			node.boxMin = glm::min(node.boxMin, pos);
+			node.boxMax = glm::max(node.boxMax, pos);
+		}
+		node.mass = mass;
+		node.com = mass > 0.0f ? weighted / mass : node.center;
+
+		for (unsigned int i = node.begin; i < node.end; ++i) {
+			unsigned int idx = _indices[i];
+			addPointQuadrupole(node.quad, p.mass[idx], glm::vec3(p.x[idx], p.y[idx], p.z[idx]) - node.com);
+		}
+	}
+	else {
+		node.boxMin = _nodes[node.firstChild].boxMin;
+		node.boxMax = _nodes[node.firstChild].boxMax;
+		for (unsigned int c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+			mass += _nodes[c].mass;
+			weighted += _nodes[c].mass * _nodes[c].com;
+			node.boxMin = glm::min(node.boxMin, _nodes[c].boxMin);
+			node.boxMax = glm::max(node.boxMax, _nodes[c].boxMax);
+		}
+		node.mass = mass;
+		node.com = mass > 0.0f ? weighted / mass : node.center;
+
+		//Parallel axis theorem
+		for (unsigned int c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+			const OctreeNode& child = _nodes[c];
+			for (unsigned int q = 0; q < 6; ++q) {
+				node.quad[q] += child.quad[q];
+			}
+			addPointQuadrupole(node.quad, child.mass, child.com - node.com);
+		}
+	}
+
+	glm::vec3 d = node.com - node.center;
+	node.delta = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+
+	glm::vec3 reach = glm::max(node.center - node.boxMin, node.boxMax - node.center);
+	node.size = std::max(_cellSizes[nodeIndex], 2.0f * std::max(std::max(reach.x, reach.y), reach.z));
+	return node.size / _cellSizes[nodeIndex];
+}
+
+void Octree::queryBox(const ParticleArrays& p, const glm::vec3& minPos, const glm::vec3& maxPos, std::vector<unsigned int>& result,
+	std::vector<unsigned int>& stack) const
+{
+	traverse([&](unsigned int index) {
+		const OctreeNode& node = _nodes[index];
+		if (glm::any(glm::lessThan(node.boxMax, minPos)) || glm::any(glm::greaterThan(node.boxMin, maxPos))) {
+			return false;
+		}
+
+		bool inside = glm::all(glm::greaterThanEqual(node.boxMin, minPos)) && glm::all(glm::lessThanEqual(node.boxMax, maxPos));
+		if (inside) {
+			result.insert(result.end(), _indices.begin() + node.begin, _indices.begin() + node.end);
+			return false;
+		}
+		if (node.childCount > 0) {
+			return true;
+		}
+
+		for (unsigned int k = node.begin; k < node.end; ++k) {
+			unsigned int i = _indices[k];
+			if (p.x[i] >= minPos.x && p.x[i] <= maxPos.x && p.y[i] >= minPos.y && p.y[i] <= maxPos.y && p.z[i] >= minPos.z && p.z[i] <= maxPos.z) {
+				result.push_back(i);
+			}
+		}
+		return false;
+	}, stack);
+}
+
+void Octree::querySphere(const ParticleArrays& p, const glm::vec3& center, float radius, std::vector<unsigned int>& result,
+	std::vector<unsigned int>& stack) const
+{
+	float radius2 = radius * radius;
+
+	traverse([&](unsigned int index) {
+		const OctreeNode& node = _nodes[index];
+
+		//Nearest and farthest points of the node box
+		glm::vec3 nearest = glm::max(glm::max(node.boxMin - center, center - node.boxMax), glm::vec3(0.0f));
+		if (nearest.x * nearest.x + nearest.y * nearest.y + nearest.z * nearest.z > radius2) {
+			return false;
+		}
+
+		glm::vec3 farthest = glm::max(glm::abs(node.boxMin - center), glm::abs(node.boxMax - center));
+		if (farthest.x * farthest.x + farthest.y * farthest.y + farthest.z * farthest.z <= radius2) {
+			result.insert(result.end(), _indices.begin() + node.begin, _indices.begin() + node.end);
+			return false;
+		}
+		if (node.childCount > 0) {
+			return true;
+		}
+
+		for (unsigned int k = node.begin; k < node.end; ++k) {
+			unsigned int i = _indices[k];
+			float dx = p.x[i] - center.x, dy = p.y[i] - center.y, dz = p.z[i] - center.z;
+			if (dx * dx + dy * dy + dz * dz <= radius2) {
+				result.push_back(i);
+			}
+		}
+		return false;
+	}, stack);
+}
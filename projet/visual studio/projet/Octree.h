@@ -0,0 +1,107 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <vector>
+#include <cstdint>
+
+#include <vec3.hpp>
+#include <common.hpp>
+
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+
+struct OctreeNode
+{
+	glm::vec3 center; //Geometric center of the cell
+	float size; //Side length of the cell
+	glm::vec3 boxMin; //Tight bounding box of the node particles
+	glm::vec3 boxMax;
+
+	glm::vec3 com; //Center of mass
+	float mass;
+	float delta; //Distance between the center of mass and the geometric center
+	float quad[6]; //Traceless quadrupole moment about com: xx, yy, zz, xy, xz, yz
+
+	unsigned int firstChild; //Children are stored contiguously
+	unsigned int childCount; //0 for a leaf
+	unsigned int begin; //Range of the node particles in the tree index array
+	unsigned int end;
+};
+
+//Octree over the positions of a ParticleArrays.
+//Nodes are stored so a child always has a greater index than its parent, the children of a node are contiguous,
+//and the particles of every node are contiguous in getIndices().
+//The build is parallel: the particles are sorted along the Morton curve by a parallel radix sort, so every cell is a range of the
+//sorted keys and its children are found by binary search on the next key digit. The top of the tree is split serially until there
+//are a few subtrees per thread, then the subtrees are built and their moments computed in parallel.
+//The cells are those of the Morton grid, whose resolution bounds the depth to 21 levels.
+//Between rebuilds the tree can be refitted: computeMoments called again after the particles moved keeps the topology and grows
+//every cell, around its center, until it contains its particles again.
+class Octree
+{
+public:
+	Octree();
+
+	void build(const ParticleArrays& p, unsigned int leafSize, ThreadPool& pool);
+	//Bounding boxes, masses, centers of mass and quadrupoles. Needed by the queries.
+	void computeMoments(const ParticleArrays& p, ThreadPool& pool);
+	//Refits the tree when maxGrowth >= 1 and the refitted cells grew by at most maxGrowth, rebuilds it otherwise.
+	//Returns true when it was rebuilt.
+	bool update(const ParticleArrays& p, unsigned int leafSize, float maxGrowth, ThreadPool& pool);
+	void invalidate() { _nodes.clear(); } //The next update rebuilds
+	float getGrowth() const { return _growth; } //Largest ratio between the size of a cell and its size when it was built
+
+	const std::vector<OctreeNode>& getNodes() const { return _nodes; }
+	const std::vector<unsigned int>& getIndices() const { return _indices; }
+	const std::vector<uint64_t>& getKeys() const { return _keys; } //Morton key of the particle at the same place in getIndices()
+
+	//Calls visit(nodeIndex) on the nodes, from the root, opening the nodes for which it returns true. stack is scratch memory
+	//so concurrent traversals each bring theirs.
+	template<typename Visitor>
+	void traverse(Visitor visit, std::vector<unsigned int>& stack) const;
+
+	//Appends to result the particles inside the box [minPos, maxPos]
+	void queryBox(const ParticleArrays& p, const glm::vec3& minPos, const glm::vec3& maxPos, std::vector<unsigned int>& result,
+		std::vector<unsigned int>& stack) const;
+	//Appends to result the particles closer than radius to center
+	void querySphere(const ParticleArrays& p, const glm::vec3& center, float radius, std::vector<unsigned int>& result,
+		std::vector<unsigned int>& stack) const;
+
+private:
+	//Pushes the non-empty children of nodes[nodeIndex] at the end of nodes, then subdivides them
+	void buildNode(std::vector<OctreeNode>& nodes, unsigned int nodeIndex, unsigned int level) const;
+	bool splitNode(std::vector<OctreeNode>& nodes, unsigned int nodeIndex, unsigned int level) const;
+	float computeNodeMoments(const ParticleArrays& p, unsigned int nodeIndex);
+
+	std::vector<OctreeNode> _nodes;
+	std::vector<unsigned int> _indices;
+	std::vector<uint64_t> _keys;
+	std::vector<float> _cellSizes; //Sizes of the cells when they were built
+	std::vector<std::vector<OctreeNode> > _subtrees; //Built in parallel, the first node being the subtree root
+	std::vector<unsigned int> _subtreeBegin; //Range of the nodes of every subtree below its root in _nodes
+	unsigned int _topCount; //Nodes before the subtrees
+	unsigned int _leafSize;
+	float _growth;
+};
+
+template<typename Visitor>
+void Octree::traverse(Visitor visit, std::vector<unsigned int>& stack) const
+{
+	if (_nodes.empty()) return;
+
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty()) {
+		unsigned int index = stack.back();
+		stack.pop_back();
+
+		if (!visit(index)) continue;
+
+		const OctreeNode& node = _nodes[index];
+		for (unsigned int c = node.childCount; c > 0; --c) {
+			stack.push_back(node.firstChild + c - 1);
+		}
+	}
+}
+
+#endif
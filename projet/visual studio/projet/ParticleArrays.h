@@ -0,0 +1,262 @@
+#ifndef PARTICLEARRAYS_H
+#define PARTICLEARRAYS_H
+
+#include <vector>
+#include <cstddef>
+#include <new>
+
+#include <xmmintrin.h>
+#include <vec3.hpp>
+
+struct Particle
+{
+	glm::vec3 pos;
+	glm::vec3 speed;
+	float mass;
+};
+
+//Allocator returning memory aligned on Alignment bytes so SIMD kernels can work on whole cache lines
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t n)
+	{
+		void* ptr = _mm_malloc(n * sizeof(T), Alignment);
+		if (!ptr) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(ptr);
+	}
+
+	void deallocate(T* ptr, size_t)
+	{
+		_mm_free(ptr);
+	}
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+	template<typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloatArray;
+typedef std::vector<double, AlignedAllocator<double>> AlignedDoubleArray;
+
+//Particle state laid out like the GPU buffers: a vec4 (position, mass) and a vec4 (speed, 0) per particle, so it is uploaded
+//and downloaded as whole arrays without repacking
+class ParticleState
+{
+public:
+	size_t size() const { return id.size(); }
+
+	//New particles get their index as id
+	void resize(size_t n)
+	{
+		size_t oldSize = size();
+		positions.resize(4 * n);
+		speeds.resize(4 * n, 0.0f);
+		id.resize(n);
+		for (size_t i = oldSize; i < n; ++i) {
+			id[i] = static_cast<unsigned int>(i);
+		}
+	}
+
+	void clear() { resize(0); }
+
+	void reserve(size_t n)
+	{
+		positions.reserve(4 * n);
+		speeds.reserve(4 * n);
+		id.reserve(n);
+	}
+
+	void push_back(const Particle& p)
+	{
+		resize(size() + 1);
+		set(size() - 1, p);
+	}
+
+	void set(size_t i, const Particle& p)
+	{
+		float* position = &positions[4 * i];
+		position[0] = p.pos.x; position[1] = p.pos.y; position[2] = p.pos.z; position[3] = p.mass;
+		float* speed = &speeds[4 * i];
+		speed[0] = p.speed.x; speed[1] = p.speed.y; speed[2] = p.speed.z;
+	}
+
+	Particle get(size_t i) const
+	{
+		Particle p;
+		p.pos = glm::vec3(positions[4 * i], positions[4 * i + 1], positions[4 * i + 2]);
+		p.speed = glm::vec3(speeds[4 * i], speeds[4 * i + 1], speeds[4 * i + 2]);
+		p.mass = positions[4 * i + 3];
+		return p;
+	}
+
+	//Packs the positions, masses and velocities of a structure of arrays
+	template<typename Arrays>
+	void assign(const Arrays& particles)
+	{
+		resize(particles.size());
+		for (size_t i = 0; i < particles.size(); ++i) {
+			float* position = &positions[4 * i];
+			position[0] = static_cast<float>(particles.x[i]);
+			position[1] = static_cast<float>(particles.y[i]);
+			position[2] = static_cast<float>(particles.z[i]);
+			position[3] = static_cast<float>(particles.mass[i]);
+			float* speed = &speeds[4 * i];
+			speed[0] = static_cast<float>(particles.vx[i]);
+			speed[1] = static_cast<float>(particles.vy[i]);
+			speed[2] = static_cast<float>(particles.vz[i]);
+			speed[3] = 0.0f;
+		}
+		id = particles.id;
+	}
+
+	std::vector<float> positions; //x, y, z, mass
+	std::vector<float> speeds; //vx, vy, vz, padding
+	std::vector<unsigned int> id; //Index of the particle in the loaded dataset
+};
+
+//Structure-of-arrays particle store used by the CPU engine, templated on its scalar type.
+//Each component lives in its own aligned array so the force kernels can stream them with vector loads.
+template<typename Real>
+class BasicParticleArrays
+{
+public:
+	typedef Real Scalar;
+	typedef std::vector<Real, AlignedAllocator<Real>> Array;
+
+	BasicParticleArrays() : _size(0) {}
+
+	//New particles get their index as id
+	void resize(size_t n)
+	{
+		x.resize(n); y.resize(n); z.resize(n);
+		mass.resize(n);
+		vx.resize(n); vy.resize(n); vz.resize(n);
+		ax.resize(n); ay.resize(n); az.resize(n);
+		jx.resize(n); jy.resize(n); jz.resize(n);
+		id.resize(n);
+		for (size_t i = _size; i < n; ++i) {
+			id[i] = static_cast<unsigned int>(i);
+		}
+		_size = n;
+	}
+
+	void clear() { resize(0); }
+
+	size_t size() const { return _size; }
+
+	void set(size_t i, const Particle& p)
+	{
+		x[i] = p.pos.x; y[i] = p.pos.y; z[i] = p.pos.z;
+		mass[i] = p.mass;
+		vx[i] = p.speed.x; vy[i] = p.speed.y; vz[i] = p.speed.z;
+	}
+
+	Particle get(size_t i) const
+	{
+		Particle p;
+		p.pos = glm::vec3(x[i], y[i], z[i]);
+		p.speed = glm::vec3(vx[i], vy[i], vz[i]);
+		p.mass = static_cast<float>(mass[i]);
+		return p;
+	}
+
+	void assign(const std::vector<Particle>& particles)
+	{
+		resize(particles.size());
+		for (size_t i = 0; i < particles.size(); ++i) {
+			set(i, particles[i]);
+			id[i] = static_cast<unsigned int>(i);
+		}
+	}
+
+	//Unpacks the positions, masses and velocities of state
+	void assign(const ParticleState& state)
+	{
+		resize(state.size());
+		for (size_t i = 0; i < state.size(); ++i) {
+			const float* position = &state.positions[4 * i];
+			x[i] = position[0]; y[i] = position[1]; z[i] = position[2];
+			mass[i] = position[3];
+			const float* speed = &state.speeds[4 * i];
+			vx[i] = speed[0]; vy[i] = speed[1]; vz[i] = speed[2];
+		}
+		id = state.id;
+	}
+
+	//Converts the positions, masses and velocities of other, which may use another scalar type
+	template<typename OtherReal>
+	void assign(const BasicParticleArrays<OtherReal>& other)
+	{
+		resize(other.size());
+		convert(other.x, x); convert(other.y, y); convert(other.z, z);
+		convert(other.mass, mass);
+		convert(other.vx, vx); convert(other.vy, vy); convert(other.vz, vz);
+		id = other.id;
+	}
+
+	//Moves particle order[k] to index k for every k
+	void permute(const std::vector<unsigned int>& order)
+	{
+		Array tmp(_size);
+		permute(order, x, tmp); permute(order, y, tmp); permute(order, z, tmp);
+		permute(order, mass, tmp);
+		permute(order, vx, tmp); permute(order, vy, tmp); permute(order, vz, tmp);
+		permute(order, ax, tmp); permute(order, ay, tmp); permute(order, az, tmp);
+		permute(order, jx, tmp); permute(order, jy, tmp); permute(order, jz, tmp);
+
+		std::vector<unsigned int> tmpId(_size);
+		permute(order, id, tmpId);
+	}
+
+	//Positions
+	Array x, y, z;
+	Array mass;
+	//Velocities
+	Array vx, vy, vz;
+	//Accelerations computed by the last force evaluation
+	Array ax, ay, az;
+	//Time derivatives of the accelerations, only computed for the Hermite integrator
+	Array jx, jy, jz;
+	//Index of the particle in the loaded dataset, kept across reorderings
+	std::vector<unsigned int> id;
+
+private:
+	template<typename Vector>
+	static void permute(const std::vector<unsigned int>& order, Vector& values, Vector& tmp)
+	{
+		for (size_t k = 0; k < order.size(); ++k) {
+			tmp[k] = values[order[k]];
+		}
+		values.swap(tmp);
+	}
+
+	template<typename Source>
+	static void convert(const Source& source, Array& destination)
+	{
+		for (size_t i = 0; i < source.size(); ++i) {
+			destination[i] = static_cast<Real>(source[i]);
+		}
+	}
+
+	size_t _size;
+};
+
+typedef BasicParticleArrays<float> ParticleArrays;
+typedef BasicParticleArrays<double> DoubleParticleArrays;
+
+#endif
@@ -0,0 +1,390 @@
+#include "ParticleMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const float PI = 3.14159265358979f;
+static const unsigned int MESH_MARGIN = 4; //Empty cells kept around the particles for the assignment and finite difference stencils
+static const float CUTOFF_FACTOR = 4.5f; //rcut = 4.5 rs, erfc(2.25) ~ 1.5e-3
+static const float SPACING_RUNGS = 16.0f; //Mesh spacings per octave, the spacing being a power of 2^(1/16)
+static const float SPACING_SLACK = 2.0f; //Rungs by which the spacing may exceed the fitting one before it is lowered
+
+//In-place iterative radix-2 FFT of a line of n (power of two) complex values
+static void fft1D(std::complex<float>* data, unsigned int n, bool inverse)
+{
+	for (unsigned int i = 1, j = 0; i < n; ++i) {
+		unsigned int bit = n >> 1;
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j) std::swap(data[i], data[j]);
+	}
+
+	for (unsigned int len = 2; len <= n; len <<= 1) {
+		double angle = 2.0 * PI / len * (inverse ? 1.0 : -1.0);
+		std::complex<float> wlen(static_cast<float>(cos(angle)), static_cast<float>(sin(angle)));
+		for (unsigned int i = 0; i < n; i += len) {
+			std::complex<float> w(1.0f, 0.0f);
+			for (unsigned int k = 0; k < len / 2; ++k) {
+				std::complex<float> u = data[i + k];
+				std::complex<float> v = data[i + k + len / 2] * w;
+				data[i + k] = u + v;
+				data[i + k + len / 2] = u - v;
+				w *= wlen;
+			}
+		}
+	}
+}
+
+ParticleMeshSolver::ParticleMeshSolver()
+	: _meshSize(64), _paddedSize(128), _assignment(ASSIGNMENT_TSC), _splitCells(1.25f), _h(1.0f), _rs(1.0f), _rcut(1.0f),
+	_greenH(0.0f), _greenEps2(0.0f), _greenRs(0.0f), _greenSize(0), _greenAssignment(0)
+{
+
+}
+
+void ParticleMeshSolver::setMeshSize(unsigned int size)
+{
+	unsigned int n = 16;
+	while (n < size) {
+		n <<= 1;
+	}
+	_meshSize = n;
+	_paddedSize = 2 * n;
+}
+
+void ParticleMeshSolver::computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	if (p.size() == 0) return;
+
+	setupMesh(p);
+	computeGreenFunction(eps2, pool);
+
+	depositMass(p, pool);
+	fft3D(_density, false, pool);
+
+	pool.parallelFor(_density.size(), 4096, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			_density[i] *= _green[i];
+		}
+	});
+
+	fft3D(_density, true, pool);
+
+	computeMeshAccelerations(pool);
+	interpolateAccelerations(p, G, pool);
+	addShortRange(p, G, eps2, pool);
+}
+
+//Centers the inner part of the mesh on the particles. The spacing is kept while they fit and are not much smaller,
+//otherwise it moves to the smallest power of 2^(1/16) holding them, so the Green's function stays cached while they move.
+void ParticleMeshSolver::setupMesh(const ParticleArrays& p)
+{
+	glm::vec3 minPos(p.x[0], p.y[0], p.z[0]);
+	glm::vec3 maxPos = minPos;
+	for (size_t i = 1; i < p.size(); ++i) {
+		minPos = glm::vec3(std::min(minPos.x, p.x[i]), std::min(minPos.y, p.y[i]), std::min(minPos.z, p.z[i]));
+		maxPos = glm::vec3(std::max(maxPos.x, p.x[i]), std::max(maxPos.y, p.y[i]), std::max(maxPos.z, p.z[i]));
+	}
+
+	glm::vec3 extent = maxPos - minPos;
+	float size = std::max(std::max(extent.x, extent.y), extent.z) * 1.001f + 1e-6f;
+
+	float fit = size / (_meshSize - 2 * MESH_MARGIN);
+	if (fit > _h || fit * powf(2.0f, SPACING_SLACK / SPACING_RUNGS) < _h) {
+		_h = powf(2.0f, ceilf(SPACING_RUNGS * log2f(fit)) / SPACING_RUNGS);
+		if (_h < fit) _h *= powf(2.0f, 1.0f / SPACING_RUNGS); //Rounding of the power
+	}
+
+	_origin = 0.5f * (minPos + maxPos) - glm::vec3(0.5f * _meshSize * _h);
+	_rs = _splitCells * _h;
+	_rcut = CUTOFF_FACTOR * _rs;
+}
+
+//Samples the long range kernel f(r) erf(r / 2rs) on the padded mesh with wrapped offsets and transforms it.
+//Only recomputed when the mesh spacing or the kernel changes. The density mesh, filled afterwards, holds the transform.
+void ParticleMeshSolver::computeGreenFunction(float eps2, ThreadPool& pool)
+{
+	if (_greenSize == _paddedSize && _greenH == _h && _greenEps2 == eps2 && _greenRs == _rs && _greenAssignment == _assignment) return;
+
+	size_t count = static_cast<size_t>(_paddedSize) * _paddedSize * _paddedSize;
+	std::vector<Complex>& green = _density;
+	green.resize(count);
+
+	pool.parallelFor(_paddedSize, 1, [&](size_t begin, size_t end) {
+		for (size_t z = begin; z < end; ++z) {
+			for (size_t y = 0; y < _paddedSize; ++y) {
+				for (size_t x = 0; x < _paddedSize; ++x) {
+					float dx = (x <= _meshSize ? static_cast<float>(x) : static_cast<float>(x) - _paddedSize) * _h;
+					float dy = (y <= _meshSize ? static_cast<float>(y) : static_cast<float>(y) - _paddedSize) * _h;
+					float dz = (z <= _meshSize ? static_cast<float>(z) : static_cast<float>(z) - _paddedSize) * _h;
+					float r2 = dx * dx + dy * dy + dz * dz;
+					float r = sqrtf(r2);
+					green[paddedIndex(x, y, z)] = Complex(erff(r / (2.0f * _rs)) / sqrtf(r2 + eps2), 0.0f);
+				}
+			}
+		}
+	});
+
+	fft3D(green, false, pool);
+
+	//Deconvolution of the assignment window, applied once for the deposit and once for the interpolation
+	std::vector<float> window(_paddedSize);
+	float order = (_assignment == ASSIGNMENT_CIC) ? 2.0f : 3.0f;
+	for (unsigned int i = 0; i < _paddedSize; ++i) {
+		int k = (i <= _paddedSize / 2) ? static_cast<int>(i) : static_cast<int>(i) - static_cast<int>(_paddedSize);
+		float arg = PI * k / _paddedSize;
+		window[i] = (k == 0) ? 1.0f : powf(sinf(arg) / arg, order);
+	}
+
+	_green.resize(count);
+	pool.parallelFor(_paddedSize, 1, [&](size_t begin, size_t end) {
+		for (size_t z = begin; z < end; ++z) {
+			for (size_t y = 0; y < _paddedSize; ++y) {
+				for (size_t x = 0; x < _paddedSize; ++x) {
+					float w = window[x] * window[y] * window[z];
+					size_t i = paddedIndex(x, y, z);
+					_green[i] = green[i].real() / (w * w);
+				}
+			}
+		}
+	});
+
+	_greenSize = _paddedSize;
+	_greenH = _h;
+	_greenEps2 = eps2;
+	_greenRs = _rs;
+	_greenAssignment = _assignment;
+}
+
+//Returns the number of mesh points touched along one axis, the first one and their weights. u is in mesh units.
+unsigned int ParticleMeshSolver::assignmentWeights(float u, int& first, float* weights) const
+{
+	if (_assignment == ASSIGNMENT_CIC) {
+		first = static_cast<int>(floorf(u));
+		float d = u - first;
+		weights[0] = 1.0f - d;
+		weights[1] = d;
+		return 2;
+	}
+
+	int nearest = static_cast<int>(floorf(u + 0.5f));
+	float d = u - nearest;
+	first = nearest - 1;
+	weights[0] = 0.5f * (0.5f - d) * (0.5f - d);
+	weights[1] = 0.75f - d * d;
+	weights[2] = 0.5f * (0.5f + d) * (0.5f + d);
+	return 3;
+}
+
+//Each thread deposits its particles in a private inner mesh, the meshes are then summed into the padded mesh.
+//Masses rather than densities are stored so the convolution directly gives sum m f.
+void ParticleMeshSolver::depositMass(const ParticleArrays& p, ThreadPool& pool)
+{
+	size_t meshCount = static_cast<size_t>(_meshSize) * _meshSize * _meshSize;
+	_threadDensity.resize(pool.getThreadCount());
+	_density.assign(static_cast<size_t>(_paddedSize) * _paddedSize * _paddedSize, Complex(0.0f, 0.0f));
+
+	float invH = 1.0f / _h;
+
+	pool.run([&](unsigned int index, unsigned int count) {
+		std::vector<float>& mesh = _threadDensity[index];
+		mesh.assign(meshCount, 0.0f);
+
+		size_t begin, end;
+		ThreadPool::splitRange(p.size(), index, count, 256, begin, end);
+		for (size_t i = begin; i < end; ++i) {
+			int first[3];
+			float weights[3][3];
+			unsigned int n = assignmentWeights((p.x[i] - _origin.x) * invH, first[0], weights[0]);
+			assignmentWeights((p.y[i] - _origin.y) * invH, first[1], weights[1]);
+			assignmentWeights((p.z[i] - _origin.z) * invH, first[2], weights[2]);
+
+			float m = p.mass[i];
+			for (unsigned int c = 0; c < n; ++c) {
+				for (unsigned int b = 0; b < n; ++b) {
+					for (unsigned int a = 0; a < n; ++a) {
+						mesh[meshIndex(first[0] + a, first[1] + b, first[2] + c)] += m * weights[0][a] * weights[1][b] * weights[2][c];
+					}
+				}
+			}
+		}
+	});
+
+	pool.parallelFor(_meshSize, 1, [&](size_t begin, size_t end) {
+		for (size_t z = begin; z < end; ++z) {
+			for (size_t y = 0; y < _meshSize; ++y) {
+				for (size_t x = 0; x < _meshSize; ++x) {
+					float rho = 0.0f;
+					for (size_t t = 0; t < _threadDensity.size(); ++t) {
+						rho += _threadDensity[t][meshIndex(x, y, z)];
+					}
+					_density[paddedIndex(x, y, z)] = Complex(rho, 0.0f);
+				}
+			}
+		}
+	});
+}
+
+//Transforms the three axes one after the other, each line being copied to a contiguous buffer
+void ParticleMeshSolver::fft3D(std::vector<Complex>& data, bool inverse, ThreadPool& pool)
+{
+	size_t n = _paddedSize;
+	size_t strides[3] = { 1, n, n * n };
+
+	for (unsigned int axis = 0; axis < 3; ++axis) {
+		size_t stride = strides[axis];
+		size_t otherStride1 = strides[(axis + 1) % 3];
+		size_t otherStride2 = strides[(axis + 2) % 3];
+
+		pool.parallelFor(n * n, 16, [&](size_t begin, size_t end) {
+			std::vector<Complex> line(n);
+			for (size_t l = begin; l < end; ++l) {
+				size_t base = (l % n) * otherStride1 + (l / n) * otherStride2;
+				for (size_t i = 0; i < n; ++i) {
+					line[i] = data[base + i * stride];
+				}
+				fft1D(line.data(), static_cast<unsigned int>(n), inverse);
+				for (size_t i = 0; i < n; ++i) {
+					data[base + i * stride] = line[i];
+				}
+			}
+		});
+	}
+
+	if (inverse) {
+		float scale = 1.0f / (static_cast<float>(n) * n * n);
+		pool.parallelFor(data.size(), 4096, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				data[i] *= scale;
+			}
+		});
+	}
+}
+
+//Fourth order finite differences of the potential. The density holds sum m f, so a = G grad(phi).
+void ParticleMeshSolver::computeMeshAccelerations(ThreadPool& pool)
+{
+	size_t meshCount = static_cast<size_t>(_meshSize) * _meshSize * _meshSize;
+	_meshAx.assign(meshCount, 0.0f);
+	_meshAy.assign(meshCount, 0.0f);
+	_meshAz.assign(meshCount, 0.0f);
+
+	float scale = 1.0f / (12.0f * _h);
+	pool.parallelFor(_meshSize - 4, 1, [&](size_t begin, size_t end) {
+		for (size_t z = begin + 2; z < end + 2; ++z) {
+			for (size_t y = 2; y < _meshSize - 2; ++y) {
+				for (size_t x = 2; x < _meshSize - 2; ++x) {
+					size_t i = meshIndex(x, y, z);
+					_meshAx[i] = scale * (8.0f * (_density[paddedIndex(x + 1, y, z)].real() - _density[paddedIndex(x - 1, y, z)].real())
+						- (_density[paddedIndex(x + 2, y, z)].real() - _density[paddedIndex(x - 2, y, z)].real()));
+					_meshAy[i] = scale * (8.0f * (_density[paddedIndex(x, y + 1, z)].real() - _density[paddedIndex(x, y - 1, z)].real())
+						- (_density[paddedIndex(x, y + 2, z)].real() - _density[paddedIndex(x, y - 2, z)].real()));
+					_meshAz[i] = scale * (8.0f * (_density[paddedIndex(x, y, z + 1)].real() - _density[paddedIndex(x, y, z - 1)].real())
+						- (_density[paddedIndex(x, y, z + 2)].real() - _density[paddedIndex(x, y, z - 2)].real()));
+				}
+			}
+		}
+	});
+}
+
+//Gathers the mesh accelerations with the same weights as the deposit so the mesh force conserves momentum
+void ParticleMeshSolver::interpolateAccelerations(ParticleArrays& p, float G, ThreadPool& pool)
+{
+	float invH = 1.0f / _h;
+
+	pool.parallelFor(p.size(), 256, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			int first[3];
+			float weights[3][3];
+			unsigned int n = assignmentWeights((p.x[i] - _origin.x) * invH, first[0], weights[0]);
+			assignmentWeights((p.y[i] - _origin.y) * invH, first[1], weights[1]);
+			assignmentWeights((p.z[i] - _origin.z) * invH, first[2], weights[2]);
+
+			glm::vec3 a(0.0f);
+			for (unsigned int c = 0; c < n; ++c) {
+				for (unsigned int b = 0; b < n; ++b) {
+					for (unsigned int k = 0; k < n; ++k) {
+						size_t idx = meshIndex(first[0] + k, first[1] + b, first[2] + c);
+						float w = weights[0][k] * weights[1][b] * weights[2][c];
+						a += w * glm::vec3(_meshAx[idx], _meshAy[idx], _meshAz[idx]);
+					}
+				}
+			}
+
+			p.ax[i] = G * a.x;
+			p.ay[i] = G * a.y;
+			p.az[i] = G * a.z;
+		}
+	});
+}
+
+//Adds the f(r) erfc(r / 2rs) part of the force for every pair closer than rcut
+void ParticleMeshSolver::addShortRange(ParticleArrays& p, float G, float eps2, ThreadPool& pool)
+{
+	float cellSize = _rcut;
+	float extent = _h * _meshSize;
+	int cellsPerAxis = std::max(1, static_cast<int>(extent / cellSize));
+	float invCellSize = cellsPerAxis / extent;
+	size_t cellCount = static_cast<size_t>(cellsPerAxis) * cellsPerAxis * cellsPerAxis;
+
+	//Counting sort of the particles by cell
+	std::vector<unsigned int> particleCell(p.size());
+	_cellStart.assign(cellCount + 1, 0);
+	for (size_t i = 0; i < p.size(); ++i) {
+		int cx = std::min(cellsPerAxis - 1, static_cast<int>((p.x[i] - _origin.x) * invCellSize));
+		int cy = std::min(cellsPerAxis - 1, static_cast<int>((p.y[i] - _origin.y) * invCellSize));
+		int cz = std::min(cellsPerAxis - 1, static_cast<int>((p.z[i] - _origin.z) * invCellSize));
+		particleCell[i] = (cz * cellsPerAxis + cy) * cellsPerAxis + cx;
+		++_cellStart[particleCell[i] + 1];
+	}
+	for (size_t c = 0; c < cellCount; ++c) {
+		_cellStart[c + 1] += _cellStart[c];
+	}
+	_cellParticles.resize(p.size());
+	std::vector<unsigned int> next(_cellStart.begin(), _cellStart.end() - 1);
+	for (size_t i = 0; i < p.size(); ++i) {
+		_cellParticles[next[particleCell[i]]++] = static_cast<unsigned int>(i);
+	}
+
+	float rcut2 = _rcut * _rcut;
+	float invTwoRs = 1.0f / (2.0f * _rs);
+	float invSqrtPiRs = 1.0f / (sqrtf(PI) * _rs);
+
+	pool.parallelFor(p.size(), 256, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			int cell = particleCell[i];
+			int cx = cell % cellsPerAxis;
+			int cy = (cell / cellsPerAxis) % cellsPerAxis;
+			int cz = cell / (cellsPerAxis * cellsPerAxis);
+
+			glm::vec3 a(0.0f);
+			for (int z = std::max(0, cz - 1); z <= std::min(cellsPerAxis - 1, cz + 1); ++z) {
+				for (int y = std::max(0, cy - 1); y <= std::min(cellsPerAxis - 1, cy + 1); ++y) {
+					for (int x = std::max(0, cx - 1); x <= std::min(cellsPerAxis - 1, cx + 1); ++x) {
+						int neighbor = (z * cellsPerAxis + y) * cellsPerAxis + x;
+						for (unsigned int k = _cellStart[neighbor]; k < _cellStart[neighbor + 1]; ++k) {
+							unsigned int j = _cellParticles[k];
+							glm::vec3 r(p.x[j] - p.x[i], p.y[j] - p.y[i], p.z[j] - p.z[i]);
+							float r2 = r.x * r.x + r.y * r.y + r.z * r.z;
+							if (r2 >= rcut2 || j == i) continue;
+
+							//-d/dr [erfc(r / 2rs) / s] / r, with s = sqrt(r^2 + eps2)
+							float dist = sqrtf(r2);
+							float invS = 1.0f / sqrtf(r2 + eps2);
+							float u = dist * invTwoRs;
+							float force = erfcf(u) * invS * invS * invS;
+							if (dist > 0.0f) force += expf(-u * u) * invSqrtPiRs * invS / dist;
+							a += (p.mass[j] * force) * r;
+						}
+					}
+				}
+			}
+
+			p.ax[i] += G * a.x;
+			p.ay[i] += G * a.y;
+			p.az[i] += G * a.z;
+		}
+	});
+}
@@ -0,0 +1,70 @@
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+
+#include <vector>
+#include <complex>
+
+#include "ForceSolver.h"
+
+enum MassAssignment
+{
+	ASSIGNMENT_CIC = 0, //Cloud in cell, 2x2x2 stencil
+	ASSIGNMENT_TSC //Triangular shaped cloud, 3x3x3 stencil
+};
+
+//P3M solver. The softened kernel is split as f(r) = f(r) erf(r / 2rs) + f(r) erfc(r / 2rs):
+//the smooth long range part is solved on a mesh by FFT convolution with a zero-padded (isolated) Green's function,
+//the short range part is summed directly over the pairs closer than a few cells using a cell list.
+class ParticleMeshSolver : public ForceSolver
+{
+public:
+	ParticleMeshSolver();
+
+	virtual void computeAccelerations(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+
+	void setMeshSize(unsigned int size); //Rounded up to a power of two
+	unsigned int getMeshSize() const { return _meshSize; }
+	void setAssignment(unsigned int assignment) { _assignment = assignment; }
+	void setSplitRadius(float cells) { _splitCells = cells; } //rs in mesh cells
+
+private:
+	typedef std::complex<float> Complex;
+
+	void setupMesh(const ParticleArrays& p);
+	void computeGreenFunction(float eps2, ThreadPool& pool);
+	void depositMass(const ParticleArrays& p, ThreadPool& pool);
+	void computeMeshAccelerations(ThreadPool& pool);
+	void interpolateAccelerations(ParticleArrays& p, float G, ThreadPool& pool);
+	void addShortRange(ParticleArrays& p, float G, float eps2, ThreadPool& pool);
+
+	void fft3D(std::vector<Complex>& data, bool inverse, ThreadPool& pool);
+	unsigned int assignmentWeights(float u, int& first, float* weights) const;
+	size_t paddedIndex(size_t x, size_t y, size_t z) const { return (z * _paddedSize + y) * _paddedSize + x; }
+	size_t meshIndex(size_t x, size_t y, size_t z) const { return (z * _meshSize + y) * _meshSize + x; }
+
+	unsigned int _meshSize; //N, the particles live in the inner part of an N^3 mesh
+	unsigned int _paddedSize; //2N
+	unsigned int _assignment;
+	float _splitCells;
+
+	glm::vec3 _origin;
+	float _h; //Mesh spacing
+	float _rs; //Split radius
+	float _rcut; //Short range cutoff
+
+	std::vector<Complex> _density; //Padded density, then potential. Also holds the transform of a new Green's function.
+	std::vector<float> _green; //Fourier transform of the long range Green's function, real since the kernel is even
+	std::vector<float> _meshAx, _meshAy, _meshAz;
+	std::vector<std::vector<float>> _threadDensity;
+
+	//Green's function cache key
+	float _greenH, _greenEps2, _greenRs;
+	unsigned int _greenSize;
+	unsigned int _greenAssignment;
+
+	//Short range cell list
+	std::vector<unsigned int> _cellStart;
+	std::vector<unsigned int> _cellParticles;
+};
+
+#endif
@@ -1,11 +1,14 @@
 #include "ShaderProg.h"
+#include "Hash.h"
 
 #include <fstream>
+#include <sstream>
+#include <cstring>
 #include <streambuf>
 #include <iostream>
 
 ShaderProg::ShaderProg()
-	: _linked(false)
+	: _program(0), _linked(false)
 {
 
 }
@@ -42,10 +45,66 @@ bool ShaderProg::loadShader(GLuint type, const std::string& filename)
 
 bool ShaderProg::loadShaderFromStr(GLuint type, const std::string& source)
 {
-	GLuint shader = glCreateShader(type);
+	ShaderSource shaderSource;
+	shaderSource.type = type;
+	shaderSource.source = source;
+	_sources.push_back(shaderSource);
+	return true;
+}
+
+//Once every shader is loaded. A lazy program is linked by its first bind(), which spares the compilation of the programs never used.
+bool ShaderProg::finalize(bool lazy)
+{
+	return lazy || link();
+}
+
+bool ShaderProg::link()
+{
+	std::string filename = binaryFilename();
+	_program = glCreateProgram();
+
+	if (!loadBinary(filename)) {
+		for (unsigned int i = 0; i < _sources.size(); ++i) {
+			compileShader(_sources[i]);
+		}
+
+		std::cout << "Creating and linking shader program... ";
+		for (unsigned int i = 0; i < _shaders.size(); ++i) {
+			glAttachShader(_program, _shaders[i]);
+		}
+		glProgramParameteri(_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(_program);
+
+		int infoLogLength;
+		glGetProgramiv(_program, GL_INFO_LOG_LENGTH, &infoLogLength);
+
+		if (infoLogLength > 1) {
+			char* log = (char*)malloc(infoLogLength);
+			glGetProgramInfoLog(_program, infoLogLength, nullptr, log);
+			std::cout << std::endl << log << std::endl << std::endl;
+			_sources.clear(); //Not retried by every bind()
+			return false;
+		}
+		else {
+			std::cout << "Done." << std::endl;
+		}
+
+		saveBinary(filename);
+	}
+
+	_sources.clear();
+	_linked = true;
+	resolveUniforms();
+
+	return true;
+}
+
+void ShaderProg::compileShader(const ShaderSource& source)
+{
+	GLuint shader = glCreateShader(source.type);
 	_shaders.push_back(shader);
 
-	const char* cStr = source.c_str();
+	const char* cStr = source.source.c_str();
 	glShaderSource(shader, 1, &cStr, nullptr);
 
 	std::cout << "Compiling shader " << "... ";
@@ -62,38 +121,96 @@ bool ShaderProg::loadShaderFromStr(GLuint type, const std::string& source)
 	else {
 		std::cout << "Done." << std::endl;
 	}
-	return true;
 }
 
-bool ShaderProg::finalize()
+//Binaries only load with the driver that produced them, which is part of the hash with the sources
+std::string ShaderProg::binaryFilename() const
 {
-	std::cout << "Creating and linking shader program... ";
-	_program = glCreateProgram();
-	for (unsigned int i = 0; i < _shaders.size(); ++i) {
-		glAttachShader(_program, _shaders[i]);
+	unsigned long long hash = FNV_OFFSET_BASIS;
+	GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : names) {
+		const char* str = reinterpret_cast<const char*>(glGetString(name));
+		if (str) {
+			hash = hashBytes(str, strlen(str), hash);
+		}
+	}
+	for (unsigned int i = 0; i < _sources.size(); ++i) {
+		hash = hashBytes(&_sources[i].type, sizeof(GLuint), hash);
+		hash = hashBytes(_sources[i].source.data(), _sources[i].source.size(), hash);
 	}
-	glLinkProgram(_program);
 
-	int infoLogLength;
-	glGetProgramiv(_program, GL_INFO_LOG_LENGTH, &infoLogLength);
+	std::ostringstream oss;
+	oss << "shaders/program_" << std::hex << hash << ".bin";
+	return oss.str();
+}
 
-	if (infoLogLength > 1) {
-		char* log = (char*)malloc(infoLogLength);
-		glGetProgramInfoLog(_program, infoLogLength, nullptr, log);
-		std::cout << std::endl << log << std::endl << std::endl;
-		return false;
+//The driver may still reject a binary, after an update for instance, the program then being built from the sources
+bool ShaderProg::loadBinary(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) return false;
+
+	GLenum format = 0;
+	file.read(reinterpret_cast<char*>(&format), sizeof(format));
+	std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (binary.empty()) return false;
+
+	glProgramBinary(_program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(_program, GL_LINK_STATUS, &status);
+	return status == GL_TRUE;
+}
+
+void ShaderProg::saveBinary(const std::string& filename) const
+{
+	GLint length = 0;
+	glGetProgramiv(_program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length == 0) return; //No binary format
+
+	GLenum format = 0;
+	std::vector<char> binary(length);
+	glGetProgramBinary(_program, length, nullptr, &format, binary.data());
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) {
+		std::cout << "Cannot write program binary " << filename << "." << std::endl;
+		return;
 	}
-	else {
-		std::cout << "Done." << std::endl;
+
+	file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	file.write(binary.data(), binary.size());
+}
+
+void ShaderProg::resolveUniforms()
+{
+	for (unsigned int i = 0; i < _vec3Uniforms.size(); ++i) {
+		_vec3Uniforms[i].id = glGetUniformLocation(_program, _vec3Uniforms[i].name.c_str());
 	}
 
-	_linked = true;
+	for (unsigned int i = 0; i < _vec4Uniforms.size(); ++i) {
+		_vec4Uniforms[i].id = glGetUniformLocation(_program, _vec4Uniforms[i].name.c_str());
+	}
 
-	return true;
+	for (unsigned int i = 0; i < _mat4x4Uniforms.size(); ++i) {
+		_mat4x4Uniforms[i].id = glGetUniformLocation(_program, _mat4x4Uniforms[i].name.c_str());
+	}
+
+	for (unsigned int i = 0; i < _floatUniforms.size(); ++i) {
+		_floatUniforms[i].id = glGetUniformLocation(_program, _floatUniforms[i].name.c_str());
+	}
+
+	for (unsigned int i = 0; i < _uintUniforms.size(); ++i) {
+		_uintUniforms[i].id = glGetUniformLocation(_program, _uintUniforms[i].name.c_str());
+	}
 }
 
-void ShaderProg::bind() const
+void ShaderProg::bind()
 {
+	if (!_linked && !_sources.empty()) {
+		link();
+	}
+
 	glUseProgram(_program);
 
 	for (unsigned int i = 0; i < _vec3Uniforms.size(); ++i) {
@@ -117,38 +234,39 @@ void ShaderProg::bind() const
 	}
 }
 
+//The locations of the uniforms of a lazy program are only known once it is linked
 void ShaderProg::registerUniform(std::string name, const glm::vec3* v)
 {
 	Vec3Uniform u(name, v);
-	u.id = glGetUniformLocation(_program, name.c_str());
+	u.id = _linked ? glGetUniformLocation(_program, name.c_str()) : 0;
 	_vec3Uniforms.push_back(u);
 }
 
 void ShaderProg::registerUniform(std::string name, const glm::vec4* v)
 {
 	Vec4Uniform u(name, v);
-	u.id = glGetUniformLocation(_program, name.c_str());
+	u.id = _linked ? glGetUniformLocation(_program, name.c_str()) : 0;
 	_vec4Uniforms.push_back(u);
 }
 
 void ShaderProg::registerUniform(std::string name, const glm::mat4x4* v)
 {
 	Mat4x4Uniform u(name, v);
-	u.id = glGetUniformLocation(_program, name.c_str());
+	u.id = _linked ? glGetUniformLocation(_program, name.c_str()) : 0;
 	_mat4x4Uniforms.push_back(u);
 }
 
 void ShaderProg::registerUniform(std::string name, const float* v)
 {
 	FloatUniform u(name, v);
-	u.id = glGetUniformLocation(_program, name.c_str());
+	u.id = _linked ? glGetUniformLocation(_program, name.c_str()) : 0;
 	_floatUniforms.push_back(u);
 }
 
 void ShaderProg::registerUniform(std::string name, const unsigned int* v)
 {
 	UintUniform u(name, v);
-	u.id = glGetUniformLocation(_program, name.c_str());
+	u.id = _linked ? glGetUniformLocation(_program, name.c_str()) : 0;
 	_uintUniforms.push_back(u);
 }
 
@@ -48,6 +48,14 @@ struct UintUniform : public Uniform
 	const unsigned int* v;
 };
 
+struct ShaderSource
+{
+	GLuint type;
+	std::string source;
+};
+
+//Linked programs are kept in a binary cache, shaders/program_<hash>.bin, the hash covering the driver and the sources,
+//so that later runs skip the compilation. A lazy program is only linked by its first bind().
 class ShaderProg
 {
 public:
@@ -56,16 +64,23 @@ public:
 
 	bool loadShader(GLuint type, const std::string& filename);
 	bool loadShaderFromStr(GLuint type, const std::string& source);
-	bool finalize();
-	void bind() const;
+	bool finalize(bool lazy = false);
+	void bind();
 	void registerUniform(std::string name, const glm::vec3* v);
 	void registerUniform(std::string name, const glm::vec4* v);
 	void registerUniform(std::string name, const glm::mat4x4* v);
 	void registerUniform(std::string name, const float* v);
 	void registerUniform(std::string name, const unsigned int* v);
 private:
+	bool link();
+	void compileShader(const ShaderSource& source);
+	void resolveUniforms();
+	std::string binaryFilename() const;
+	bool loadBinary(const std::string& filename);
+	void saveBinary(const std::string& filename) const;
 	std::string loadFile(const std::string& filename) const;
 
+	std::vector<ShaderSource> _sources; //Kept until the program is linked
 	std::vector<GLuint> _shaders;
 	GLuint _program;
 	bool _linked;
@@ -0,0 +1,185 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+//Thin wrappers over the widest vector instruction set enabled at compile time.
+//Kernels are written once against vfloat and the v* functions and work with any SIMD_WIDTH, including 1.
+//vdouble overloads the same functions for double precision kernels, with DSIMD_WIDTH lanes.
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+#define SIMD_WIDTH 16
+typedef __m512 vfloat;
+
+inline vfloat vload(const float* p) { return _mm512_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm512_storeu_ps(p, a); }
+inline vfloat vset1(float a) { return _mm512_set1_ps(a); }
+inline vfloat vzero() { return _mm512_setzero_ps(); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm512_fmadd_ps(a, b, c); } //a * b + c
+inline vfloat vfnmadd(vfloat a, vfloat b, vfloat c) { return _mm512_fnmadd_ps(a, b, c); } //c - a * b
+inline vfloat vrsqrtApprox(vfloat a) { return _mm512_rsqrt14_ps(a); }
+inline float vhsum(vfloat a) { return _mm512_reduce_add_ps(a); }
+
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER)) //MSVC does not define __FMA__ but /arch:AVX2 implies it
+
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+
+inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat vset1(float a) { return _mm256_set1_ps(a); }
+inline vfloat vzero() { return _mm256_setzero_ps(); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+inline vfloat vfnmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fnmadd_ps(a, b, c); }
+inline vfloat vrsqrtApprox(vfloat a) { return _mm256_rsqrt_ps(a); }
+inline float vhsum(vfloat a)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+
+#include <xmmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 vfloat;
+
+inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+inline vfloat vset1(float a) { return _mm_set1_ps(a); }
+inline vfloat vzero() { return _mm_setzero_ps(); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline vfloat vfnmadd(vfloat a, vfloat b, vfloat c) { return _mm_sub_ps(c, _mm_mul_ps(a, b)); }
+inline vfloat vrsqrtApprox(vfloat a) { return _mm_rsqrt_ps(a); }
+inline float vhsum(vfloat a)
+{
+	__m128 s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+#else
+
+#include <cmath>
+#define SIMD_WIDTH 1
+typedef float vfloat;
+
+inline vfloat vload(const float* p) { return *p; }
+inline void vstore(float* p, vfloat a) { *p = a; }
+inline vfloat vset1(float a) { return a; }
+inline vfloat vzero() { return 0.0f; }
+inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+inline vfloat vfnmadd(vfloat a, vfloat b, vfloat c) { return c - a * b; }
+inline vfloat vrsqrtApprox(vfloat a) { return 1.0f / sqrtf(a); }
+inline float vhsum(vfloat a) { return a; }
+
+#endif
+
+//Reciprocal square root refined with one Newton-Raphson iteration: y = y * (1.5 - 0.5 * a * y * y)
+inline vfloat vrsqrt(vfloat a)
+{
+#if SIMD_WIDTH == 1
+	return vrsqrtApprox(a);
+#else
+	vfloat y = vrsqrtApprox(a);
+	vfloat halfA = vmul(a, vset1(0.5f));
+	return vmul(y, vfnmadd(halfA, vmul(y, y), vset1(1.5f)));
+#endif
+}
+
+//Double precision
+
+#if defined(__AVX512F__)
+
+#define DSIMD_WIDTH 8
+typedef __m512d vdouble;
+
+inline vdouble vload(const double* p) { return _mm512_loadu_pd(p); }
+inline void vstore(double* p, vdouble a) { _mm512_storeu_pd(p, a); }
+inline vdouble vset1(double a) { return _mm512_set1_pd(a); }
+inline vdouble vzerod() { return _mm512_setzero_pd(); }
+inline vdouble vadd(vdouble a, vdouble b) { return _mm512_add_pd(a, b); }
+inline vdouble vsub(vdouble a, vdouble b) { return _mm512_sub_pd(a, b); }
+inline vdouble vmul(vdouble a, vdouble b) { return _mm512_mul_pd(a, b); }
+inline vdouble vdiv(vdouble a, vdouble b) { return _mm512_div_pd(a, b); }
+inline vdouble vfmadd(vdouble a, vdouble b, vdouble c) { return _mm512_fmadd_pd(a, b, c); }
+inline vdouble vfnmadd(vdouble a, vdouble b, vdouble c) { return _mm512_fnmadd_pd(a, b, c); }
+inline vdouble vsqrt(vdouble a) { return _mm512_sqrt_pd(a); }
+
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+
+#define DSIMD_WIDTH 4
+typedef __m256d vdouble;
+
+inline vdouble vload(const double* p) { return _mm256_loadu_pd(p); }
+inline void vstore(double* p, vdouble a) { _mm256_storeu_pd(p, a); }
+inline vdouble vset1(double a) { return _mm256_set1_pd(a); }
+inline vdouble vzerod() { return _mm256_setzero_pd(); }
+inline vdouble vadd(vdouble a, vdouble b) { return _mm256_add_pd(a, b); }
+inline vdouble vsub(vdouble a, vdouble b) { return _mm256_sub_pd(a, b); }
+inline vdouble vmul(vdouble a, vdouble b) { return _mm256_mul_pd(a, b); }
+inline vdouble vdiv(vdouble a, vdouble b) { return _mm256_div_pd(a, b); }
+inline vdouble vfmadd(vdouble a, vdouble b, vdouble c) { return _mm256_fmadd_pd(a, b, c); }
+inline vdouble vfnmadd(vdouble a, vdouble b, vdouble c) { return _mm256_fnmadd_pd(a, b, c); }
+inline vdouble vsqrt(vdouble a) { return _mm256_sqrt_pd(a); }
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+#define DSIMD_WIDTH 2
+typedef __m128d vdouble;
+
+inline vdouble vload(const double* p) { return _mm_loadu_pd(p); }
+inline void vstore(double* p, vdouble a) { _mm_storeu_pd(p, a); }
+inline vdouble vset1(double a) { return _mm_set1_pd(a); }
+inline vdouble vzerod() { return _mm_setzero_pd(); }
+inline vdouble vadd(vdouble a, vdouble b) { return _mm_add_pd(a, b); }
+inline vdouble vsub(vdouble a, vdouble b) { return _mm_sub_pd(a, b); }
+inline vdouble vmul(vdouble a, vdouble b) { return _mm_mul_pd(a, b); }
+inline vdouble vdiv(vdouble a, vdouble b) { return _mm_div_pd(a, b); }
+inline vdouble vfmadd(vdouble a, vdouble b, vdouble c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+inline vdouble vfnmadd(vdouble a, vdouble b, vdouble c) { return _mm_sub_pd(c, _mm_mul_pd(a, b)); }
+inline vdouble vsqrt(vdouble a) { return _mm_sqrt_pd(a); }
+
+#else
+
+#include <cmath>
+#define DSIMD_WIDTH 1
+typedef double vdouble;
+
+inline vdouble vload(const double* p) { return *p; }
+inline void vstore(double* p, vdouble a) { *p = a; }
+inline vdouble vset1(double a) { return a; }
+inline vdouble vzerod() { return 0.0; }
+inline vdouble vadd(vdouble a, vdouble b) { return a + b; }
+inline vdouble vsub(vdouble a, vdouble b) { return a - b; }
+inline vdouble vmul(vdouble a, vdouble b) { return a * b; }
+inline vdouble vdiv(vdouble a, vdouble b) { return a / b; }
+inline vdouble vfmadd(vdouble a, vdouble b, vdouble c) { return a * b + c; }
+inline vdouble vfnmadd(vdouble a, vdouble b, vdouble c) { return c - a * b; }
+inline vdouble vsqrt(vdouble a) { return sqrt(a); }
+
+#endif
+
+//Exact reciprocal square root, there is no double estimate before AVX-512
+inline vdouble vrsqrt(vdouble a)
+{
+	return vdiv(vset1(1.0), vsqrt(a));
+}
+
+#endif
@@ -0,0 +1,139 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <emmintrin.h>
+
+static const unsigned int SPIN_COUNT = 20000; //Number of pause instructions before a worker goes to sleep
+
+void SpinBarrier::wait()
+{
+	unsigned int generation = _generation.load(std::memory_order_acquire);
+
+	if (_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == _count) {
+		_arrived.store(0, std::memory_order_relaxed);
+		_generation.fetch_add(1, std::memory_order_release);
+		return;
+	}
+
+	while (_generation.load(std::memory_order_acquire) == generation) {
+		_mm_pause();
+	}
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: _threadCount(0), _task(nullptr), _generation(0), _pending(0), _stop(false)
+{
+	setThreadCount(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	stopWorkers();
+}
+
+void ThreadPool::setThreadCount(unsigned int threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	if (threadCount == _threadCount) return;
+
+	stopWorkers();
+	_threadCount = threadCount;
+	startWorkers();
+}
+
+void ThreadPool::run(const Task& task)
+{
+	if (_workers.empty()) {
+		task(0, 1);
+		return;
+	}
+
+	_task = &task;
+	_pending.store(static_cast<unsigned int>(_workers.size()), std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_generation.fetch_add(1, std::memory_order_release);
+	}
+	_wake.notify_all();
+
+	task(0, _threadCount);
+
+	while (_pending.load(std::memory_order_acquire) != 0) {
+		_mm_pause();
+	}
+	_task = nullptr;
+}
+
+void ThreadPool::parallelFor(size_t size, size_t granularity, const std::function<void(size_t, size_t)>& body)
+{
+	run([&](unsigned int index, unsigned int count) {
+		size_t begin, end;
+		splitRange(size, index, count, granularity, begin, end);
+		if (begin < end) {
+			body(begin, end);
+		}
+	});
+}
+
+void ThreadPool::splitRange(size_t size, unsigned int index, unsigned int count, size_t granularity, size_t& begin, size_t& end)
+{
+	size_t blocks = (size + granularity - 1) / granularity;
+	size_t blocksPerThread = blocks / count;
+	size_t extra = blocks % count; //The first extra threads get one more block
+
+	size_t firstBlock = index * blocksPerThread + std::min<size_t>(index, extra);
+	size_t blockCount = blocksPerThread + (index < extra ? 1 : 0);
+
+	begin = std::min(size, firstBlock * granularity);
+	end = std::min(size, (firstBlock + blockCount) * granularity);
+}
+
+void ThreadPool::startWorkers()
+{
+	_stop = false;
+	_barrier.setCount(_threadCount);
+
+	for (unsigned int i = 1; i < _threadCount; ++i) {
+		_workers.push_back(std::thread(&ThreadPool::workerLoop, this, i, _generation.load()));
+	}
+}
+
+void ThreadPool::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (unsigned int i = 0; i < _workers.size(); ++i) {
+		_workers[i].join();
+	}
+	_workers.clear();
+}
+
+void ThreadPool::workerLoop(unsigned int index, unsigned int seenGeneration)
+{
+	while (true) {
+		unsigned int spins = 0;
+		while (_generation.load(std::memory_order_acquire) == seenGeneration && !_stop) {
+			if (++spins < SPIN_COUNT) {
+				_mm_pause();
+			}
+			else {
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [&]() { return _generation.load(std::memory_order_acquire) != seenGeneration || _stop; });
+			}
+		}
+
+		if (_stop) return;
+
+		seenGeneration = _generation.load(std::memory_order_acquire);
+		(*_task)(index, _threadCount);
+		_pending.fetch_sub(1, std::memory_order_release);
+	}
+}
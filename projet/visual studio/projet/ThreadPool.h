@@ -0,0 +1,67 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//Barrier on which a fixed number of threads spin until the last one arrives
+class SpinBarrier
+{
+public:
+	SpinBarrier() : _count(1), _arrived(0), _generation(0) {}
+
+	void setCount(unsigned int count) { _count = count; }
+	void wait();
+
+private:
+	unsigned int _count;
+	std::atomic<unsigned int> _arrived;
+	std::atomic<unsigned int> _generation;
+};
+
+//Persistent pool of worker threads.
+//Workers spin for a short while after each task so back-to-back phases do not pay for a wake up, then sleep on a condition variable.
+class ThreadPool
+{
+public:
+	typedef std::function<void(unsigned int, unsigned int)> Task; //Called with (threadIndex, threadCount)
+
+	explicit ThreadPool(unsigned int threadCount = 0); //0 = one thread per hardware core
+	~ThreadPool();
+
+	void setThreadCount(unsigned int threadCount);
+	unsigned int getThreadCount() const { return _threadCount; }
+
+	//Runs task on every thread of the pool, the calling thread being thread 0, and returns once they are all done
+	void run(const Task& task);
+	//Synchronizes all the threads executing the current task. Must only be called from inside run().
+	void barrier() { _barrier.wait(); }
+	//Splits [0, size) in one contiguous range per thread and calls body(begin, end) for each one in parallel
+	void parallelFor(size_t size, size_t granularity, const std::function<void(size_t, size_t)>& body);
+
+	//Computes the range of [0, size) handled by thread index. Range boundaries are multiples of granularity.
+	static void splitRange(size_t size, unsigned int index, unsigned int count, size_t granularity, size_t& begin, size_t& end);
+
+private:
+	void startWorkers();
+	void stopWorkers();
+	void workerLoop(unsigned int index, unsigned int seenGeneration);
+
+	unsigned int _threadCount;
+	std::vector<std::thread> _workers;
+	const Task* _task;
+
+	std::atomic<unsigned int> _generation; //Incremented every time a new task is posted
+	std::atomic<unsigned int> _pending; //Number of workers still running the current task
+	std::atomic<bool> _stop;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+
+	SpinBarrier _barrier;
+};
+
+#endif
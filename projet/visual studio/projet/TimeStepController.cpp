@@ -0,0 +1,71 @@
+#include "TimeStepController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const double MIN_FRACTION = 1.0 / (1 << 20); //Smallest step relative to dtMax
+
+TimeStepController::TimeStepController()
+	: _eta(0.05f), _iterations(3), _tolerance(0.01), _previousStart(-1.0), _timeStep(0.0)
+{
+
+}
+
+//Largest |a|^2 of the particles, reduced from the maximum of every thread
+template<typename Real>
+static double maxAcceleration2(const BasicParticleArrays<Real>& p, ThreadPool& pool)
+{
+	std::vector<double> threadMax(pool.getThreadCount(), 0.0);
+
+	pool.run([&](unsigned int index, unsigned int count) {
+		size_t begin, end;
+		ThreadPool::splitRange(p.size(), index, count, 64, begin, end);
+
+		double maxAccel2 = 0.0;
+		for (size_t i = begin; i < end; ++i) {
+			double accel2 = static_cast<double>(p.ax[i]) * p.ax[i] + static_cast<double>(p.ay[i]) * p.ay[i] + static_cast<double>(p.az[i]) * p.az[i];
+			maxAccel2 = std::max(maxAccel2, accel2);
+		}
+		threadMax[index] = maxAccel2;
+	});
+
+	return *std::max_element(threadMax.begin(), threadMax.end());
+}
+
+//Smallest time scale sqrt(eps / |a|) of the particles, the square roots being taken once from the largest |a|^2
+static double minimumCriterion(double maxAccel2, float eps2)
+{
+	if (maxAccel2 <= 0.0) {
+		return std::numeric_limits<double>::max();
+	}
+	return std::sqrt(std::sqrt(static_cast<double>(eps2)) / std::sqrt(maxAccel2));
+}
+
+double TimeStepController::criterion(const ParticleArrays& p, float eps2, ThreadPool& pool) const
+{
+	return criterion(minimumCriterion(maxAcceleration2(p, pool), eps2));
+}
+
+double TimeStepController::criterion(const DoubleParticleArrays& p, float eps2, ThreadPool& pool) const
+{
+	return criterion(minimumCriterion(maxAcceleration2(p, pool), eps2));
+}
+
+double TimeStepController::guess(double start, double dtMax) const
+{
+	if (_previousStart <= 0.0 || start >= std::numeric_limits<double>::max()) {
+		return clamp(start, dtMax);
+	}
+	return clamp(start + 0.5 * (start - _previousStart), dtMax);
+}
+
+bool TimeStepController::converged(double dt, double symmetric, unsigned int iteration) const
+{
+	return iteration + 1 >= _iterations || std::abs(symmetric - dt) <= _tolerance * dt;
+}
+
+double TimeStepController::clamp(double dt, double dtMax) const
+{
+	return std::max(dtMax * MIN_FRACTION, std::min(dt, dtMax));
+}
@@ -0,0 +1,51 @@
+#ifndef TIMESTEPCONTROLLER_H
+#define TIMESTEPCONTROLLER_H
+
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+
+//Adaptive global time step: tau = eta * min_i sqrt(eps / |a_i|), eps being the softening length, clamped to [dtMax / 2^20, dtMax].
+//To keep the integration time-symmetric (Hut, Makino & McMillan 1995) the step taken from x0 to x1 is (tau(x0) + tau(x1)) / 2,
+//found by iterating from an extrapolated guess. The softening has to be positive.
+class TimeStepController
+{
+public:
+	TimeStepController();
+
+	void setAccuracy(float eta) { _eta = eta; }
+	float getAccuracy() const { return _eta; }
+	//Maximum number of trial steps and relative change of dt under which the last one is accepted
+	void setIterations(unsigned int iterations, double tolerance) { _iterations = iterations > 0 ? iterations : 1; _tolerance = tolerance; }
+	unsigned int getIterations() const { return _iterations; }
+
+	//Forgets the history, to call when the state jumps
+	void reset() { _previousStart = -1.0; }
+
+	//tau of the particles from their current accelerations
+	double criterion(const ParticleArrays& p, float eps2, ThreadPool& pool) const;
+	double criterion(const DoubleParticleArrays& p, float eps2, ThreadPool& pool) const;
+	//tau from min_i sqrt(eps / |a_i|) computed elsewhere, the GPU for instance
+	double criterion(double minimum) const { return _eta * minimum; }
+
+	//First trial step: tau extrapolated linearly to the end of the step from the two last starts, averaged with tau at the start
+	double guess(double start, double dtMax) const;
+	//Time-symmetric step for tau at both ends
+	double symmetric(double start, double end, double dtMax) const { return clamp(0.5 * (start + end), dtMax); }
+	//True when trial step dt needs no further iteration
+	bool converged(double dt, double symmetric, unsigned int iteration) const;
+	//Records the step taken
+	void accept(double start, double dt) { _previousStart = start; _timeStep = dt; }
+
+	double getTimeStep() const { return _timeStep; } //Time step of the last accepted step
+
+private:
+	double clamp(double dt, double dtMax) const;
+
+	float _eta;
+	unsigned int _iterations;
+	double _tolerance;
+	double _previousStart; //tau at the start of the previous step, negative when unknown
+	double _timeStep;
+};
+
+#endif
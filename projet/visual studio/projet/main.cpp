@@ -58,6 +58,12 @@ void keyboard(unsigned char key, int x, int y)
 	case 'g':
 		simulation->setOnGPU(!simulation->isOnGPU());
 		break;
+	case 'e':
+		simulation->printEnergy();
+		break;
+	case 's':
+		simulation->saveSnapshot("snapshot.dat");
+		break;
 	}
 }
 
@@ -103,6 +109,11 @@ void dessiner()
 		cout << "FPS : " << frameCount;
 		cout << "   Particles : " << simulation->getParticleCount();
 		cout << "   Group size : " << simulation->getGroupSize();
+		cout << "   CPU threads : " << simulation->getThreadCount();
+		if (!simulation->isOnGPU()) {
+			cout << "   Forces per particle per step : " << simulation->getForceEvaluationsPerParticle();
+		}
+		cout << "   Dt : " << simulation->getTimeStep();
 		cout << "   Status : " << (simulation->isOnGPU() ? "running on GPU" : "running on CPU") << std::endl;
 		frameCount = 0;
 	}
@@ -232,6 +243,123 @@ void processWorkSizeMenu(int option)
 	simulation->setGroupSize(option);
 }
 
+void processThreadsMenu(int option)
+{
+	simulation->setThreadCount(option);
+}
+
+void processCPUSolverMenu(int option)
+{
+	simulation->setCPUSolver(option);
+}
+
+void processGPUSolverMenu(int option)
+{
+	simulation->setGPUSolver(option);
+}
+
+void processPrecisionMenu(int option)
+{
+	simulation->setCPUPrecision(option);
+}
+
+void processReorderMenu(int option)
+{
+	simulation->setReorderInterval(option);
+}
+
+void processEnergyMenu(int option)
+{
+	simulation->setEnergyInterval(option);
+}
+
+void processSnapshotMenu(int option)
+{
+	simulation->setSnapshotInterval(option);
+}
+
+void processIntegratorMenu(int option)
+{
+	simulation->setIntegrator(option);
+}
+
+void processTimeStepMenu(int option)
+{
+	switch (option) {
+	case 0:
+		simulation->setAdaptiveTimeStep(0.0f);
+		break;
+	case 1:
+		simulation->setAdaptiveTimeStep(0.1f);
+		break;
+	case 2:
+		simulation->setAdaptiveTimeStep(0.05f);
+		break;
+	case 3:
+		simulation->setAdaptiveTimeStep(0.02f);
+		break;
+	}
+}
+
+void processThetaMenu(int option)
+{
+	switch (option) {
+	case 0:
+		simulation->setTheta(0.3f);
+		break;
+	case 1:
+		simulation->setTheta(0.5f);
+		break;
+	case 2:
+		simulation->setTheta(0.7f);
+		break;
+	case 3:
+		simulation->setTheta(1.0f);
+		break;
+	}
+}
+
+void processTreeReuseMenu(int option)
+{
+	switch (option) {
+	case 0:
+		simulation->setTreeReuse(0.0f, 1);
+		break;
+	case 1:
+		simulation->setTreeReuse(1.25f, 1);
+		break;
+	case 2:
+		simulation->setTreeReuse(1.25f, 4);
+		break;
+	}
+}
+
+void processFMMOrderMenu(int option)
+{
+	simulation->setFMMOrder(option);
+}
+
+void processMeshMenu(int option)
+{
+	switch (option) {
+	case 0:
+		simulation->setMeshSize(32);
+		break;
+	case 1:
+		simulation->setMeshSize(64);
+		break;
+	case 2:
+		simulation->setMeshSize(128);
+		break;
+	case 3:
+		simulation->setMassAssignment(ASSIGNMENT_CIC);
+		break;
+	case 4:
+		simulation->setMassAssignment(ASSIGNMENT_TSC);
+		break;
+	}
+}
+
 void processOpacityMenu(int option)
 {
 	switch (option) {
@@ -347,14 +475,111 @@ int main(int argc, char** argv)
 	glutAddMenuEntry("0.2", 8);
 	glutAddMenuEntry("0.1", 9);
 
+	int threadsMenu = glutCreateMenu(processThreadsMenu);
+	glutAddMenuEntry("All cores", 0);
+	glutAddMenuEntry("1", 1);
+	glutAddMenuEntry("2", 2);
+	glutAddMenuEntry("4", 4);
+	glutAddMenuEntry("8", 8);
+	glutAddMenuEntry("16", 16);
+	glutAddMenuEntry("32", 32);
+	glutAddMenuEntry("64", 64);
+
+	int CPUSolverMenu = glutCreateMenu(processCPUSolverMenu);
+	glutAddMenuEntry("Direct sum", CPU_DIRECT_SUM);
+	glutAddMenuEntry("Direct sum (symmetric pairs)", CPU_DIRECT_SUM_SYMMETRIC);
+	glutAddMenuEntry("Barnes-Hut", CPU_BARNES_HUT);
+	glutAddMenuEntry("Barnes-Hut, group walk", CPU_GROUP_TREE);
+	glutAddMenuEntry("Fast multipole method", CPU_FMM);
+	glutAddMenuEntry("Particle mesh (P3M)", CPU_PARTICLE_MESH);
+
+	int GPUSolverMenu = glutCreateMenu(processGPUSolverMenu);
+	glutAddMenuEntry("Direct sum", GPU_DIRECT_SUM);
+	glutAddMenuEntry("Barnes-Hut", GPU_BARNES_HUT);
+
+	int precisionMenu = glutCreateMenu(processPrecisionMenu);
+	glutAddMenuEntry("Float", CPU_PRECISION_FLOAT);
+	glutAddMenuEntry("Double", CPU_PRECISION_DOUBLE);
+	glutAddMenuEntry("Mixed (float pairs, compensated sums)", CPU_PRECISION_MIXED);
+
+	int reorderMenu = glutCreateMenu(processReorderMenu);
+	glutAddMenuEntry("Off", 0);
+	glutAddMenuEntry("Every 10 ticks", 10);
+	glutAddMenuEntry("Every 100 ticks", 100);
+	glutAddMenuEntry("Every 1000 ticks", 1000);
+
+	int energyMenu = glutCreateMenu(processEnergyMenu);
+	glutAddMenuEntry("Off", 0);
+	glutAddMenuEntry("Every 10 ticks", 10);
+	glutAddMenuEntry("Every 100 ticks", 100);
+	glutAddMenuEntry("Every 1000 ticks", 1000);
+
+	int snapshotMenu = glutCreateMenu(processSnapshotMenu);
+	glutAddMenuEntry("Off", 0);
+	glutAddMenuEntry("Every 100 ticks", 100);
+	glutAddMenuEntry("Every 1000 ticks", 1000);
+	glutAddMenuEntry("Every 10000 ticks", 10000);
+
+	int integratorMenu = glutCreateMenu(processIntegratorMenu);
+	glutAddMenuEntry("Leapfrog", CPU_INTEGRATOR_LEAPFROG);
+	glutAddMenuEntry("Leapfrog with block time steps (CPU only)", CPU_INTEGRATOR_BLOCK_LEAPFROG);
+	glutAddMenuEntry("Hermite 4th order", CPU_INTEGRATOR_HERMITE);
+	glutAddMenuEntry("Forest-Ruth 4th order", CPU_INTEGRATOR_FOREST_RUTH);
+	glutAddMenuEntry("Yoshida 6th order", CPU_INTEGRATOR_YOSHIDA6);
+	glutAddMenuEntry("PEFRL 4th order", CPU_INTEGRATOR_PEFRL);
+
+	int timeStepMenu = glutCreateMenu(processTimeStepMenu);
+	glutAddMenuEntry("Fixed (Dt)", 0);
+	glutAddMenuEntry("Adaptive, eta 0.1 (Dt is the largest step)", 1);
+	glutAddMenuEntry("Adaptive, eta 0.05 (Dt is the largest step)", 2);
+	glutAddMenuEntry("Adaptive, eta 0.02 (Dt is the largest step)", 3);
+
+	int thetaMenu = glutCreateMenu(processThetaMenu);
+	glutAddMenuEntry("0.3", 0);
+	glutAddMenuEntry("0.5", 1);
+	glutAddMenuEntry("0.7", 2);
+	glutAddMenuEntry("1.0", 3);
+
+	int treeReuseMenu = glutCreateMenu(processTreeReuseMenu);
+	glutAddMenuEntry("Rebuild every evaluation", 0);
+	glutAddMenuEntry("Refit until a cell grows by 25%", 1);
+	glutAddMenuEntry("Refit, group walk lists reused 4 times", 2);
+
+	int FMMOrderMenu = glutCreateMenu(processFMMOrderMenu);
+	glutAddMenuEntry("2", 2);
+	glutAddMenuEntry("3", 3);
+	glutAddMenuEntry("4", 4);
+	glutAddMenuEntry("6", 6);
+	glutAddMenuEntry("8", 8);
+
+	int meshMenu = glutCreateMenu(processMeshMenu);
+	glutAddMenuEntry("32^3", 0);
+	glutAddMenuEntry("64^3", 1);
+	glutAddMenuEntry("128^3", 2);
+	glutAddMenuEntry("Cloud in cell", 3);
+	glutAddMenuEntry("Triangular shaped cloud", 4);
+
 	int mainMenu = glutCreateMenu(processMainMenu);
-	glutAddSubMenu("GPU optimization", optiMenu);
+	glutAddSubMenu("Optimization (GPU + CPU)", optiMenu);
 	glutAddSubMenu("Particles", particlesMenu);
 	glutAddSubMenu("Work group size", groupSizeMenu);
 	glutAddSubMenu("Dt", dtMenu);
 	glutAddSubMenu("G", gMenu);
 	glutAddSubMenu("EPS2", eps2Menu);
 	glutAddSubMenu("Particle opacity", opacityMenu);
+	glutAddSubMenu("CPU threads", threadsMenu);
+	glutAddSubMenu("CPU solver", CPUSolverMenu);
+	glutAddSubMenu("GPU solver", GPUSolverMenu);
+	glutAddSubMenu("CPU precision", precisionMenu);
+	glutAddSubMenu("Integrator", integratorMenu);
+	glutAddSubMenu("Time step", timeStepMenu);
+	glutAddSubMenu("Morton reordering", reorderMenu);
+	glutAddSubMenu("Print energy", energyMenu);
+	glutAddSubMenu("Save snapshots", snapshotMenu);
+	glutAddSubMenu("Tree theta", thetaMenu);
+	glutAddSubMenu("Tree reuse", treeReuseMenu);
+	glutAddSubMenu("FMM order", FMMOrderMenu);
+	glutAddSubMenu("Particle mesh", meshMenu);
 	glutAddMenuEntry("play/pause", 0);
 	glutAddMenuEntry("reset", 1);
 	glutAddMenuEntry("Compute on CPU", 2);
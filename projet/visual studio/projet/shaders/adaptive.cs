@@ -0,0 +1,124 @@
+#version 430
+layout(local_size_x = /*SIZE*/) in;
+
+//Leapfrog with an adaptive time step. Speeds stay synchronized with the positions and the last accelerations are stored, so a step is
+//stage 0 (half-kick with the stored acceleration and drift), a memory barrier, then stage 1 (new acceleration and closing half-kick).
+//Stage 2 only evaluates, to initialize the stored accelerations. Stages 1 and 2 lower criterion.value to min sqrt(eps / |a|).
+//The last work group may extend past the particles, its extra invocations only loading massless tiles.
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(binding = 1) buffer InOut2 {
+	vec4 s[];
+} speed;
+
+layout(binding = 2) buffer InOut3 {
+	vec4 a[];
+} acceleration;
+
+layout(binding = 6) buffer InOut7 {
+	uint value; //Bits of a positive float, whose order is the order of the unsigned integers
+} criterion;
+
+uniform float EPS2 = 0.000001;
+uniform float timeStep = 0.2;
+uniform float G = 1.0;
+uniform uint optimization = 1; //Between 0 and 2
+uniform uint stage = 0;
+
+shared vec4 sharedPositions[gl_WorkGroupSize.x];
+shared uint groupCriterion;
+
+void computeInteraction(in vec3 myPosition, in vec4 pos, inout vec3 a)
+{
+	vec3 r = pos.xyz - myPosition;
+	float distSqr = dot(r, r) + EPS2;
+	float distSixth = distSqr * distSqr * distSqr;
+	a += (G * pos.w * inversesqrt(distSixth)) * r;
+}
+
+//Massless past the end of the particles
+vec4 particlePosition(uint i)
+{
+	return i < positions.pos.length() ? positions.pos[i] : vec4(0.0);
+}
+
+void computeBlockAccel(in vec3 myPosition, inout vec3 a)
+{
+	/*REPEAT(computeInteraction(myPosition, sharedPositions[#ID#], a);)*/
+}
+
+vec3 computeAccel()
+{
+	vec3 a = vec3(0.0, 0.0, 0.0);
+	vec3 myPosition = particlePosition(gl_GlobalInvocationID.x).xyz;
+
+	if (optimization == 2) { //Memory access optimized and loop unrolling
+		uint tile;
+		for (uint i = 0, tile = 0; i < positions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
+			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+			sharedPositions[gl_LocalInvocationID.x] = particlePosition(idx);
+			barrier();
+			computeBlockAccel(myPosition, a);
+			barrier();
+		}
+	} else if (optimization == 1) { //Memory access optimized
+		uint tile;
+		for (uint i = 0, tile = 0; i < positions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
+			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+			sharedPositions[gl_LocalInvocationID.x] = particlePosition(idx);
+			barrier();
+			for (uint j = 0; j < gl_WorkGroupSize.x; ++j) {
+				computeInteraction(myPosition, sharedPositions[j], a);
+			}
+			barrier();
+		}
+	} else { //Naive approach
+		for (uint i = 0; i < positions.pos.length(); ++i) {
+			computeInteraction(myPosition, positions.pos[i], a);
+		}
+	}
+
+	return a;
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	bool inside = index < positions.pos.length();
+
+	if (stage == 0) {
+		if (!inside) return;
+
+		vec3 s = speed.s[index].xyz + (0.5 * timeStep) * acceleration.a[index].xyz;
+		speed.s[index] = vec4(s, 0.0);
+		positions.pos[index] += vec4(timeStep * s, 0.0);
+		return;
+	}
+
+	if (gl_LocalInvocationID.x == 0) {
+		groupCriterion = floatBitsToUint(3.0e38);
+	}
+	barrier();
+
+	vec3 a = computeAccel();
+	if (inside) {
+		acceleration.a[index] = vec4(a, 0.0);
+		if (stage == 1) {
+			speed.s[index] += vec4((0.5 * timeStep) * a, 0.0);
+		}
+	}
+
+	//Reduced in shared memory first so there is one global atomic per work group
+	float accel = length(a);
+	if (inside && accel > 0.0) {
+		atomicMin(groupCriterion, floatBitsToUint(sqrt(sqrt(EPS2) / accel)));
+	}
+	barrier();
+
+	if (gl_LocalInvocationID.x == 0) {
+		atomicMin(criterion.value, groupCriterion);
+	}
+}
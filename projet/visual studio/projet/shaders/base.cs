@@ -1,14 +1,26 @@
 #version 430
 layout(local_size_x = /*SIZE*/) in;
 
-layout(binding = 0) buffer Input0 {
+//The state is read from the bindings 0 and 1 and the next one written to 15 and 16, which the host swaps after the dispatch:
+//every work group reads the positions of the same tick whatever the order in which the work groups run.
+//The last work group may extend past the particles, its extra invocations only loading massless tiles.
+
+layout(binding = 0) readonly buffer Input0 {
 	vec4 pos[];
 } positions;
 
-layout(binding = 1) buffer InOut2 {
+layout(binding = 1) readonly buffer Input1 {
 	vec3 s[];
 } speed;
 
+layout(binding = 15) writeonly buffer Output0 {
+	vec4 pos[];
+} nextPositions;
+
+layout(binding = 16) writeonly buffer Output1 {
+	vec3 s[];
+} nextSpeed;
+
 uniform float EPS2 = 0.000001;
 uniform float dt = 0.2;
 uniform float G = 1.0;
@@ -24,6 +36,15 @@ void computeInteraction(in vec3 myPosition, in vec4 pos, inout vec3 a)
 	a += (G * pos.w * inversesqrt(distSixth)) * r;
 }
 
+//Position of particle i after the drift of this tick, massless past the end of the particles
+vec4 driftedPosition(uint i)
+{
+	if (i >= positions.pos.length()) return vec4(0.0);
+
+	vec4 p = positions.pos[i];
+	return vec4(p.xyz + dt * speed.s[i], p.w);
+}
+
 void computeBlockAccel(in vec3 myPosition, inout vec3 a)
 {
 	/*REPEAT(computeInteraction(myPosition, sharedPositions[#ID#], a);)*/
@@ -32,13 +53,13 @@ void computeBlockAccel(in vec3 myPosition, inout vec3 a)
 vec3 computeAccel()
 {
 	vec3 a = vec3(0.0, 0.0, 0.0);
-	vec3 myPosition = positions.pos[gl_GlobalInvocationID.x].xyz;
+	vec3 myPosition = driftedPosition(gl_GlobalInvocationID.x).xyz;
 	
 	if (optimization == 2) { //Memory access optimized and loop unrolling
 		uint tile;
 		for (uint i = 0, tile = 0; i < positions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
 			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
-			sharedPositions[gl_LocalInvocationID.x] = positions.pos[idx];
+			sharedPositions[gl_LocalInvocationID.x] = driftedPosition(idx);
 			barrier();
 			computeBlockAccel(myPosition, a);
 			barrier();
@@ -47,7 +68,7 @@ vec3 computeAccel()
 		uint tile;
 		for (uint i = 0, tile = 0; i < positions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
 			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
-			sharedPositions[gl_LocalInvocationID.x] = positions.pos[idx];
+			sharedPositions[gl_LocalInvocationID.x] = driftedPosition(idx);
 			barrier();
 			for (uint j = 0; j < gl_WorkGroupSize.x; ++j) {
 				computeInteraction(myPosition, sharedPositions[j], a);
@@ -56,7 +77,7 @@ vec3 computeAccel()
 		}
 	} else { //Naive approach
 		for (uint i = 0; i < positions.pos.length(); ++i) {
-			computeInteraction(myPosition, positions.pos[i], a);
+			computeInteraction(myPosition, driftedPosition(i), a);
 		}
 	}
 	
@@ -66,7 +87,10 @@ vec3 computeAccel()
 void main()
 {
 	//Leapfrog integration
-	vec3 s = speed.s[gl_GlobalInvocationID.x];
-	positions.pos[gl_GlobalInvocationID.x] += vec4(dt * s, 0.0);
-	speed.s[gl_GlobalInvocationID.x] = s + dt * computeAccel();
+	uint index = gl_GlobalInvocationID.x;
+	vec3 a = computeAccel();
+	if (index >= positions.pos.length()) return;
+
+	nextPositions.pos[index] = driftedPosition(index);
+	nextSpeed.s[index] = speed.s[index] + dt * a;
 }
@@ -0,0 +1,22 @@
+#version 430
+layout(local_size_x = /*SIZE*/) in;
+
+//Drift of the composition integrators: positions += coefficient * dt * speeds
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(binding = 1) buffer InOut2 {
+	vec3 s[];
+} speed;
+
+uniform float dt = 0.2;
+uniform float coefficient = 1.0; //Fraction of dt of this drift
+
+void main()
+{
+	if (gl_GlobalInvocationID.x >= positions.pos.length()) return;
+
+	positions.pos[gl_GlobalInvocationID.x] += vec4((coefficient * dt) * speed.s[gl_GlobalInvocationID.x], 0.0);
+}
@@ -0,0 +1,139 @@
+#version 430
+layout(local_size_x = /*SIZE*/) in;
+
+//Fourth-order Hermite integrator. A step takes two dispatches separated by a memory barrier:
+//stage 0 predicts every particle, stage 2 evaluates the acceleration and the jerk at the predicted state and corrects.
+//Stages 1 and 3 do the same with a copy of the current state instead of a prediction, to initialize the acceleration and the jerk.
+//The last work group may extend past the particles, its extra invocations only loading massless tiles.
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(binding = 1) buffer InOut2 {
+	vec4 s[];
+} speed;
+
+layout(binding = 2) buffer InOut3 {
+	vec4 a[];
+} acceleration;
+
+layout(binding = 3) buffer InOut4 {
+	vec4 j[];
+} jerk;
+
+layout(binding = 4) buffer InOut5 {
+	vec4 pos[];
+} predictedPositions;
+
+layout(binding = 5) buffer InOut6 {
+	vec4 s[];
+} predictedSpeed;
+
+uniform float EPS2 = 0.000001;
+uniform float dt = 0.2;
+uniform float G = 1.0;
+uniform uint optimization = 1; //Between 0 and 2
+uniform uint stage = 0; //0 = predict, 1 = copy, 2 = evaluate and correct, 3 = evaluate only
+
+shared vec4 sharedPositions[gl_WorkGroupSize.x];
+shared vec4 sharedSpeeds[gl_WorkGroupSize.x];
+
+void computeInteraction(in vec3 myPosition, in vec3 mySpeed, in vec4 pos, in vec4 s, inout vec3 a, inout vec3 j)
+{
+	vec3 r = pos.xyz - myPosition;
+	vec3 v = s.xyz - mySpeed;
+	float distSqr = dot(r, r) + EPS2;
+	float invDist = inversesqrt(distSqr);
+	float invDist2 = invDist * invDist;
+	float f = pos.w * invDist * invDist2;
+	a += f * r;
+	j += f * (v - (3.0 * invDist2 * dot(r, v)) * r);
+}
+
+//Predicted state of particle i, massless and at rest past the end of the particles
+void predictedState(in uint i, out vec4 pos, out vec4 s)
+{
+	bool inside = i < predictedPositions.pos.length();
+	pos = inside ? predictedPositions.pos[i] : vec4(0.0);
+	s = inside ? predictedSpeed.s[i] : vec4(0.0);
+}
+
+void computeBlockAccelJerk(in vec3 myPosition, in vec3 mySpeed, inout vec3 a, inout vec3 j)
+{
+	/*REPEAT(computeInteraction(myPosition, mySpeed, sharedPositions[#ID#], sharedSpeeds[#ID#], a, j);)*/
+}
+
+void computeAccelJerk(out vec3 a, out vec3 j)
+{
+	a = vec3(0.0, 0.0, 0.0);
+	j = vec3(0.0, 0.0, 0.0);
+	vec4 myPosition4, mySpeed4;
+	predictedState(gl_GlobalInvocationID.x, myPosition4, mySpeed4);
+	vec3 myPosition = myPosition4.xyz;
+	vec3 mySpeed = mySpeed4.xyz;
+
+	if (optimization == 2) { //Memory access optimized and loop unrolling
+		uint tile;
+		for (uint i = 0, tile = 0; i < predictedPositions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
+			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+			predictedState(idx, sharedPositions[gl_LocalInvocationID.x], sharedSpeeds[gl_LocalInvocationID.x]);
+			barrier();
+			computeBlockAccelJerk(myPosition, mySpeed, a, j);
+			barrier();
+		}
+	} else if (optimization == 1) { //Memory access optimized
+		uint tile;
+		for (uint i = 0, tile = 0; i < predictedPositions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
+			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+			predictedState(idx, sharedPositions[gl_LocalInvocationID.x], sharedSpeeds[gl_LocalInvocationID.x]);
+			barrier();
+			for (uint k = 0; k < gl_WorkGroupSize.x; ++k) {
+				computeInteraction(myPosition, mySpeed, sharedPositions[k], sharedSpeeds[k], a, j);
+			}
+			barrier();
+		}
+	} else { //Naive approach
+		for (uint i = 0; i < predictedPositions.pos.length(); ++i) {
+			computeInteraction(myPosition, mySpeed, predictedPositions.pos[i], predictedSpeed.s[i], a, j);
+		}
+	}
+
+	a *= G;
+	j *= G;
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	vec3 a1, j1;
+	if (stage >= 2) {
+		computeAccelJerk(a1, j1);
+	}
+	if (index >= positions.pos.length()) return;
+
+	vec4 x0 = positions.pos[index];
+	vec3 v0 = speed.s[index].xyz;
+
+	if (stage == 0) {
+		vec3 a0 = acceleration.a[index].xyz;
+		vec3 j0 = jerk.j[index].xyz;
+		predictedPositions.pos[index] = vec4(x0.xyz + dt * (v0 + dt * (0.5 * a0 + (dt / 6.0) * j0)), x0.w);
+		predictedSpeed.s[index] = vec4(v0 + dt * (a0 + (0.5 * dt) * j0), 0.0);
+	} else if (stage == 1) {
+		predictedPositions.pos[index] = x0;
+		predictedSpeed.s[index] = vec4(v0, 0.0);
+	} else {
+		if (stage == 2) {
+			vec3 a0 = acceleration.a[index].xyz;
+			vec3 j0 = jerk.j[index].xyz;
+			float twelfth = dt * dt / 12.0;
+			vec3 v1 = v0 + (0.5 * dt) * (a0 + a1) + twelfth * (j0 - j1);
+			positions.pos[index] = vec4(x0.xyz + (0.5 * dt) * (v0 + v1) + twelfth * (a0 - a1), x0.w);
+			speed.s[index] = vec4(v1, 0.0);
+		}
+
+		acceleration.a[index] = vec4(a1, 0.0);
+		jerk.j[index] = vec4(j1, 0.0);
+	}
+}
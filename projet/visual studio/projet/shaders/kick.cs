@@ -0,0 +1,100 @@
+#version 430
+layout(local_size_x = /*SIZE*/) in;
+
+//Kick of the composition integrators: speeds += coefficient * dt * acceleration.
+//Positions are only read, the dispatch has to be separated from the drifts by a memory barrier.
+//Stage 1 also stores the accelerations and stage 2 kicks with the stored ones, which is how the leapfrog half-step is taken.
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(binding = 1) buffer InOut2 {
+	vec3 s[];
+} speed;
+
+layout(binding = 17) buffer InOut3 {
+	vec4 a[];
+} storedAcceleration;
+
+uniform float EPS2 = 0.000001;
+uniform float dt = 0.2;
+uniform float G = 1.0;
+uniform uint optimization = 1; //Between 0 and 2
+uniform float coefficient = 1.0; //Fraction of dt of this kick
+uniform uint stage = 0; //0 = evaluate and kick, 1 = evaluate, store and kick, 2 = kick with the stored accelerations
+
+shared vec4 sharedPositions[gl_WorkGroupSize.x];
+
+void computeInteraction(in vec3 myPosition, in vec4 pos, inout vec3 a)
+{
+	vec3 r = pos.xyz - myPosition;
+	float distSqr = dot(r, r) + EPS2;
+	float distSixth = distSqr * distSqr * distSqr;
+	a += (G * pos.w * inversesqrt(distSixth)) * r;
+}
+
+//Massless past the end of the particles, which the last work group may extend over
+vec4 particlePosition(uint i)
+{
+	return i < positions.pos.length() ? positions.pos[i] : vec4(0.0);
+}
+
+void computeBlockAccel(in vec3 myPosition, inout vec3 a)
+{
+	/*REPEAT(computeInteraction(myPosition, sharedPositions[#ID#], a);)*/
+}
+
+vec3 computeAccel()
+{
+	vec3 a = vec3(0.0, 0.0, 0.0);
+	vec3 myPosition = particlePosition(gl_GlobalInvocationID.x).xyz;
+	
+	if (optimization == 2) { //Memory access optimized and loop unrolling
+		uint tile;
+		for (uint i = 0, tile = 0; i < positions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
+			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+			sharedPositions[gl_LocalInvocationID.x] = particlePosition(idx);
+			barrier();
+			computeBlockAccel(myPosition, a);
+			barrier();
+		}
+	} else if (optimization == 1) { //Memory access optimized
+		uint tile;
+		for (uint i = 0, tile = 0; i < positions.pos.length(); i += gl_WorkGroupSize.x, ++tile) {
+			uint idx = tile * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+			sharedPositions[gl_LocalInvocationID.x] = particlePosition(idx);
+			barrier();
+			for (uint j = 0; j < gl_WorkGroupSize.x; ++j) {
+				computeInteraction(myPosition, sharedPositions[j], a);
+			}
+			barrier();
+		}
+	} else { //Naive approach
+		for (uint i = 0; i < positions.pos.length(); ++i) {
+			computeInteraction(myPosition, positions.pos[i], a);
+		}
+	}
+	
+	return a;
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	vec3 a;
+
+	if (stage == 2) {
+		if (index >= positions.pos.length()) return;
+		a = storedAcceleration.a[index].xyz;
+	}
+	else {
+		a = computeAccel();
+		if (index >= positions.pos.length()) return;
+		if (stage == 1) {
+			storedAcceleration.a[index] = vec4(a, 0.0);
+		}
+	}
+
+	speed.s[index] += (coefficient * dt) * a;
+}
@@ -0,0 +1,152 @@
+#version 430
+layout(local_size_x = 256) in;
+
+//One pass of the LSD radix sort of the (key, value) pairs of the GPU tree, on the 4-bit digit at shift.
+//Stage 0 counts the digits of every tile of 256 keys into histogram[digit * tiles + tile], stage 1 turns the histogram into
+//exclusive offsets in a single work group, and stage 2 scatters every tile, the rank of a key among the keys of its tile with
+//the same digit keeping the sort stable. Input and output buffers are swapped by the host between passes.
+
+layout(std430, binding = 8) buffer KeysIn {
+	uint k[];
+} keysIn;
+
+layout(std430, binding = 9) buffer ValuesIn {
+	uint v[];
+} valuesIn;
+
+layout(std430, binding = 10) buffer KeysOut {
+	uint k[];
+} keysOut;
+
+layout(std430, binding = 11) buffer ValuesOut {
+	uint v[];
+} valuesOut;
+
+layout(std430, binding = 12) buffer Histogram {
+	uint h[];
+} histogram;
+
+uniform uint count = 0;
+uniform uint shift = 0;
+uniform uint stage = 0;
+
+const uint RADIX = 16u;
+const uint TILE = gl_WorkGroupSize.x;
+
+shared uint tileCount[RADIX];
+shared uint partialSums[TILE];
+shared uvec4 counters[2][2][TILE]; //Double-buffered scan of 16 packed 16-bit counters per key
+
+uint digitOf(uint index)
+{
+	return index < count ? (keysIn.k[index] >> shift) & (RADIX - 1u) : RADIX;
+}
+
+void countDigits()
+{
+	uint tiles = gl_NumWorkGroups.x;
+
+	if (gl_LocalInvocationID.x < RADIX) {
+		tileCount[gl_LocalInvocationID.x] = 0u;
+	}
+	barrier();
+
+	uint digit = digitOf(gl_GlobalInvocationID.x);
+	if (digit < RADIX) {
+		atomicAdd(tileCount[digit], 1u);
+	}
+	barrier();
+
+	if (gl_LocalInvocationID.x < RADIX) {
+		histogram.h[gl_LocalInvocationID.x * tiles + gl_WorkGroupID.x] = tileCount[gl_LocalInvocationID.x];
+	}
+}
+
+//Exclusive scan of the whole histogram, each invocation scanning a contiguous chunk
+void scanHistogram()
+{
+	uint size = histogram.h.length();
+	uint chunk = (size + TILE - 1u) / TILE;
+	uint begin = min(gl_LocalInvocationID.x * chunk, size);
+	uint end = min(begin + chunk, size);
+
+	uint sum = 0u;
+	for (uint i = begin; i < end; ++i) {
+		sum += histogram.h[i];
+	}
+	partialSums[gl_LocalInvocationID.x] = sum;
+	barrier();
+
+	if (gl_LocalInvocationID.x == 0) {
+		uint offset = 0u;
+		for (uint t = 0; t < TILE; ++t) {
+			uint s = partialSums[t];
+			partialSums[t] = offset;
+			offset += s;
+		}
+	}
+	barrier();
+
+	uint offset = partialSums[gl_LocalInvocationID.x];
+	for (uint i = begin; i < end; ++i) {
+		uint h = histogram.h[i];
+		histogram.h[i] = offset;
+		offset += h;
+	}
+}
+
+void scatter()
+{
+	uint tiles = gl_NumWorkGroups.x;
+	uint local = gl_LocalInvocationID.x;
+	uint digit = digitOf(gl_GlobalInvocationID.x);
+
+	//One-hot counter of the digit, 16-bit counters packed by pairs
+	uvec4 low = uvec4(0u), high = uvec4(0u);
+	if (digit < 8u) {
+		low[digit >> 1] = 1u << (16u * (digit & 1u));
+	}
+	else if (digit < RADIX) {
+		high[(digit - 8u) >> 1] = 1u << (16u * (digit & 1u));
+	}
+	counters[0][0][local] = low;
+	counters[0][1][local] = high;
+	barrier();
+
+	//Inclusive Hillis-Steele scan over the tile
+	uint source = 0u;
+	for (uint offset = 1u; offset < TILE; offset <<= 1) {
+		low = counters[source][0][local];
+		high = counters[source][1][local];
+		if (local >= offset) {
+			low += counters[source][0][local - offset];
+			high += counters[source][1][local - offset];
+		}
+		counters[1u - source][0][local] = low;
+		counters[1u - source][1][local] = high;
+		source = 1u - source;
+		barrier();
+	}
+
+	if (digit < RADIX) {
+		uvec4 scanned = counters[source][digit >> 3][local];
+		uint rank = ((scanned[(digit & 7u) >> 1] >> (16u * (digit & 1u))) & 0xffffu) - 1u;
+		uint destination = histogram.h[digit * tiles + gl_WorkGroupID.x] + rank;
+
+		keysOut.k[destination] = keysIn.k[gl_GlobalInvocationID.x];
+		valuesOut.v[destination] = valuesIn.v[gl_GlobalInvocationID.x];
+	}
+}
+
+void main()
+{
+	if (stage == 0) {
+		countDigits();
+	}
+	else if (stage == 1) {
+		scanHistogram();
+	}
+	else {
+		scatter();
+	}
+}
@@ -0,0 +1,63 @@
+#version 430
+layout(local_size_x = 256) in;
+
+//Gathers the state of the particles along the Morton order sorted by the GPU tree, whose value buffer lists the particle of every slot.
+//Positions and speeds go to the next state buffers, accelerations and jerks to the predicted buffers of the Hermite integrator
+//and the original indices to the next id buffer, the host swapping every pair once the dispatch is done.
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(binding = 1) buffer Input1 {
+	vec4 s[];
+} speed;
+
+layout(binding = 2) buffer Input2 {
+	vec4 a[];
+} acceleration;
+
+layout(binding = 3) buffer Input3 {
+	vec4 j[];
+} jerk;
+
+layout(std430, binding = 9) buffer Values {
+	uint v[];
+} values;
+
+layout(std430, binding = 18) buffer Ids {
+	uint id[];
+} ids;
+
+layout(binding = 15) writeonly buffer Output0 {
+	vec4 pos[];
+} nextPositions;
+
+layout(binding = 16) writeonly buffer Output1 {
+	vec4 s[];
+} nextSpeed;
+
+layout(binding = 4) writeonly buffer Output2 {
+	vec4 a[];
+} nextAcceleration;
+
+layout(binding = 5) writeonly buffer Output3 {
+	vec4 j[];
+} nextJerk;
+
+layout(std430, binding = 19) writeonly buffer Output4 {
+	uint id[];
+} nextIds;
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	if (index >= positions.pos.length()) return;
+
+	uint source = values.v[index];
+	nextPositions.pos[index] = positions.pos[source];
+	nextSpeed.s[index] = speed.s[source];
+	nextAcceleration.a[index] = acceleration.a[source];
+	nextJerk.j[index] = jerk.j[source];
+	nextIds.id[index] = ids.id[source];
+}
@@ -0,0 +1,239 @@
+#version 430
+layout(local_size_x = 256) in;
+
+//Construction of the Barnes-Hut tree of the GPU, a binary radix tree over the Morton keys of the particles (Karras 2012).
+//Stage 0 reduces the bounding box of the particles, stage 1 computes their 30-bit Morton keys, which are then sorted by
+//radix_sort.cs. Stage 2 builds the internal nodes from the sorted keys, stage 3 links every node to the node following its
+//subtree in depth-first order so the walk needs no stack, and stage 4 accumulates the boxes and moments from the leaves up.
+//Internal node i is node i, the root being node 0, and the leaf of the k-th sorted particle is node count - 1 + k.
+
+struct Node {
+	vec4 com; //Center of mass, mass in w
+	vec4 boxMin; //w: squared distance under which the node is opened, negative for the leaves which are never opened
+	vec4 boxMax;
+	uvec4 links; //Left child, right child, parent and escape, the node following the subtree
+};
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(std430, binding = 7) buffer TreeInfo {
+	uint boxMin[3]; //Bounding box of the particles as order-preserving integers
+	uint boxMax[3];
+} info;
+
+layout(std430, binding = 8) buffer Keys {
+	uint k[];
+} keys;
+
+layout(std430, binding = 9) buffer Values {
+	uint v[];
+} values;
+
+layout(std430, binding = 13) coherent buffer Nodes {
+	Node n[];
+} nodes;
+
+layout(std430, binding = 14) buffer Flags {
+	uint f[];
+} flags;
+
+uniform uint count = 0; //Number of particles
+uniform uint stage = 0;
+uniform float theta = 0.5;
+
+const uint NONE = 0xffffffffu;
+
+shared uint groupMin[3];
+shared uint groupMax[3];
+
+//Maps a float to an unsigned integer with the same order
+uint orderedBits(float f)
+{
+	uint bits = floatBitsToUint(f);
+	return (bits & 0x80000000u) != 0u ? ~bits : bits | 0x80000000u;
+}
+
+float orderedFloat(uint bits)
+{
+	return uintBitsToFloat((bits & 0x80000000u) != 0u ? bits & 0x7fffffffu : ~bits);
+}
+
+//Spreads the 10 low bits of v so that two zero bits separate each of them
+uint spreadBits(uint v)
+{
+	v &= 0x3ffu;
+	v = (v | (v << 16)) & 0x030000ffu;
+	v = (v | (v << 8)) & 0x0300f00fu;
+	v = (v | (v << 4)) & 0x030c30c3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+//Length of the common prefix of the keys i and j, the index breaking the ties of equal keys. -1 outside of the keys.
+int commonPrefix(int i, int j)
+{
+	if (j < 0 || j >= int(count)) return -1;
+
+	uint a = keys.k[i];
+	uint b = keys.k[j];
+	if (a == b) return 32 + 31 - findMSB(uint(i ^ j));
+	return 31 - findMSB(a ^ b);
+}
+
+void computeBounds(uint index)
+{
+	if (gl_LocalInvocationID.x == 0) {
+		for (uint c = 0; c < 3; ++c) {
+			groupMin[c] = 0xffffffffu;
+			groupMax[c] = 0u;
+		}
+	}
+	barrier();
+
+	if (index < count) {
+		vec3 p = positions.pos[index].xyz;
+		for (uint c = 0; c < 3; ++c) {
+			atomicMin(groupMin[c], orderedBits(p[c]));
+			atomicMax(groupMax[c], orderedBits(p[c]));
+		}
+	}
+	barrier();
+
+	//One global atomic per work group
+	if (gl_LocalInvocationID.x == 0) {
+		for (uint c = 0; c < 3; ++c) {
+			atomicMin(info.boxMin[c], groupMin[c]);
+			atomicMax(info.boxMax[c], groupMax[c]);
+		}
+	}
+}
+
+void computeKey(uint index)
+{
+	vec3 minPos = vec3(orderedFloat(info.boxMin[0]), orderedFloat(info.boxMin[1]), orderedFloat(info.boxMin[2]));
+	vec3 maxPos = vec3(orderedFloat(info.boxMax[0]), orderedFloat(info.boxMax[1]), orderedFloat(info.boxMax[2]));
+	vec3 extent = maxPos - minPos;
+	float maxExtent = max(extent.x, max(extent.y, extent.z));
+	float scale = maxExtent > 0.0 ? 1023.0 / maxExtent : 0.0;
+
+	uvec3 q = uvec3(min(vec3(1023.0), (positions.pos[index].xyz - minPos) * scale));
+	keys.k[index] = spreadBits(q.x) | (spreadBits(q.y) << 1) | (spreadBits(q.z) << 2);
+	values.v[index] = index;
+}
+
+//Finds the range of keys covered by internal node i and where it splits
+void buildInternalNode(int i)
+{
+	int d = commonPrefix(i, i + 1) - commonPrefix(i, i - 1) > 0 ? 1 : -1;
+
+	//Other end of the range, by exponential then binary search
+	int minPrefix = commonPrefix(i, i - d);
+	int maxLength = 2;
+	while (commonPrefix(i, i + maxLength * d) > minPrefix) {
+		maxLength *= 2;
+	}
+	int length = 0;
+	for (int t = maxLength / 2; t >= 1; t /= 2) {
+		if (commonPrefix(i, i + (length + t) * d) > minPrefix) {
+			length += t;
+		}
+	}
+	int j = i + length * d;
+
+	//Split: last key sharing more than the prefix of the range with key i
+	int nodePrefix = commonPrefix(i, j);
+	int split = 0;
+	int t = length;
+	do {
+		t = (t + 1) / 2;
+		if (commonPrefix(i, i + (split + t) * d) > nodePrefix) {
+			split += t;
+		}
+	} while (t > 1);
+	int gamma = i + split * d + min(d, 0);
+
+	uint leafOffset = count - 1u;
+	uint left = min(i, j) == gamma ? leafOffset + uint(gamma) : uint(gamma);
+	uint right = max(i, j) == gamma + 1 ? leafOffset + uint(gamma) + 1u : uint(gamma) + 1u;
+
+	nodes.n[i].links.x = left;
+	nodes.n[i].links.y = right;
+	nodes.n[left].links.z = uint(i);
+	nodes.n[right].links.z = uint(i);
+	flags.f[i] = 0u;
+}
+
+//The escape of a left child is its sibling, the escape of a right child the escape of its parent
+void linkNode(uint index)
+{
+	uint node = index;
+	while (node != 0u) {
+		uint parent = nodes.n[node].links.z;
+		if (nodes.n[parent].links.x == node) {
+			nodes.n[index].links.w = nodes.n[parent].links.y;
+			return;
+		}
+		node = parent;
+	}
+	nodes.n[index].links.w = NONE;
+}
+
+//Sets the leaf of the k-th sorted particle, then goes up while this thread is the second to reach the nodes
+void accumulate(uint k)
+{
+	uint leaf = count - 1u + k;
+	vec4 p = positions.pos[values.v[k]];
+	nodes.n[leaf].com = p;
+	nodes.n[leaf].boxMin = vec4(p.xyz, -1.0);
+	nodes.n[leaf].boxMax = vec4(p.xyz, 0.0);
+
+	uint node = leaf;
+	while (node != 0u) {
+		node = nodes.n[node].links.z;
+
+		memoryBarrierBuffer();
+		if (atomicAdd(flags.f[node], 1u) == 0u) return; //The sibling subtree is not done yet
+
+		uvec4 links = nodes.n[node].links;
+		vec4 a = nodes.n[links.x].com;
+		vec4 b = nodes.n[links.y].com;
+		vec3 boxMin = min(nodes.n[links.x].boxMin.xyz, nodes.n[links.y].boxMin.xyz);
+		vec3 boxMax = max(nodes.n[links.x].boxMax.xyz, nodes.n[links.y].boxMax.xyz);
+
+		float mass = a.w + b.w;
+		vec3 com = mass > 0.0 ? (a.w * a.xyz + b.w * b.xyz) / mass : 0.5 * (boxMin + boxMax);
+
+		//Same criterion as the CPU: opened when d < size / theta + delta, delta being the offset of the center of mass
+		vec3 extent = boxMax - boxMin;
+		float size = max(extent.x, max(extent.y, extent.z));
+		float delta = length(com - 0.5 * (boxMin + boxMax));
+		float openDist = size / theta + delta;
+
+		nodes.n[node].com = vec4(com, mass);
+		nodes.n[node].boxMin = vec4(boxMin, openDist * openDist);
+		nodes.n[node].boxMax = vec4(boxMax, 0.0);
+	}
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+
+	if (stage == 0) {
+		computeBounds(index);
+	}
+	else if (stage == 1) {
+		if (index < count) computeKey(index);
+	}
+	else if (stage == 2) {
+		if (index + 1u < count) buildInternalNode(int(index));
+	}
+	else if (stage == 3) {
+		if (index < 2u * count - 1u) linkNode(index);
+	}
+	else {
+		if (index < count) accumulate(index);
+	}
+}
@@ -0,0 +1,73 @@
+#version 430
+layout(local_size_x = 128) in;
+
+//Barnes-Hut walk of the tree built by tree_build.cs. Invocation k handles the k-th particle along the Morton curve so the
+//invocations of a work group, being close in space, follow nearly the same path. The walk needs no stack: an accepted node or
+//a leaf continues with the escape link of the node, an opened node with its left child.
+//The acceleration is stored and, when kick is not 0, speeds += kick * dt * acceleration.
+
+struct Node {
+	vec4 com; //Center of mass, mass in w
+	vec4 boxMin; //w: squared distance under which the node is opened, negative for the leaves
+	vec4 boxMax;
+	uvec4 links; //Left child, right child, parent and escape
+};
+
+layout(binding = 0) buffer Input0 {
+	vec4 pos[];
+} positions;
+
+layout(binding = 1) buffer InOut2 {
+	vec3 s[];
+} speed;
+
+layout(binding = 2) buffer InOut3 {
+	vec4 a[];
+} acceleration;
+
+layout(std430, binding = 9) buffer Values {
+	uint v[];
+} values;
+
+layout(std430, binding = 13) buffer Nodes {
+	Node n[];
+} nodes;
+
+uniform float EPS2 = 0.000001;
+uniform float dt = 0.2;
+uniform float G = 1.0;
+uniform uint count = 0;
+uniform float kick = 0.0; //Fraction of dt of the kick
+
+const uint NONE = 0xffffffffu;
+
+void main()
+{
+	if (gl_GlobalInvocationID.x >= count) return;
+
+	uint index = values.v[gl_GlobalInvocationID.x];
+	vec3 myPosition = positions.pos[index].xyz;
+	vec3 a = vec3(0.0, 0.0, 0.0);
+
+	uint node = 0u;
+	while (node != NONE) {
+		vec4 com = nodes.n[node].com;
+		vec3 r = com.xyz - myPosition;
+		float dist2 = dot(r, r);
+
+		if (dist2 > nodes.n[node].boxMin.w) {
+			float distSqr = dist2 + EPS2;
+			a += (com.w * inversesqrt(distSqr * distSqr * distSqr)) * r;
+			node = nodes.n[node].links.w;
+		}
+		else {
+			node = nodes.n[node].links.x;
+		}
+	}
+
+	a *= G;
+	acceleration.a[index] = vec4(a, 0.0);
+	if (kick != 0.0) {
+		speed.s[index] += (kick * dt) * a;
+	}
+}